@@ -0,0 +1,86 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace NEONnoir
+{
+    // Blocking queue with a fixed capacity, for connecting the stages of a pipeline. A producer
+    // that gets too far ahead is made to wait, which caps how much is in flight at any time.
+    template<typename T>
+    class bounded_queue
+    {
+    public:
+        explicit bounded_queue(size_t capacity) : _capacity{ capacity } {}
+
+        // Blocks while the queue is full. Returns false if it was closed in the meantime.
+        bool push(T&& value)
+        {
+            {
+                auto lock = std::unique_lock{ _mutex };
+                _not_full.wait(lock, [this] { return _is_closed || _items.size() < _capacity; });
+                if (_is_closed)
+                    return false;
+
+                _items.push_back(std::move(value));
+            }
+
+            _not_empty.notify_one();
+            return true;
+        }
+
+        // Blocks while the queue is empty. Returns nothing once it's closed and drained.
+        std::optional<T> pop()
+        {
+            auto value = std::optional<T>{};
+
+            {
+                auto lock = std::unique_lock{ _mutex };
+                _not_empty.wait(lock, [this] { return _is_closed || !_items.empty(); });
+                if (_items.empty())
+                    return std::nullopt;
+
+                value = std::move(_items.front());
+                _items.pop_front();
+            }
+
+            _not_full.notify_one();
+            return value;
+        }
+
+        // No more items are coming, whatever is left can still be popped
+        void close()
+        {
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                _is_closed = true;
+            }
+
+            _not_full.notify_all();
+            _not_empty.notify_all();
+        }
+
+        // Something went wrong, drop everything and wake everyone up
+        void abort()
+        {
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                _is_closed = true;
+                _items.clear();
+            }
+
+            _not_full.notify_all();
+            _not_empty.notify_all();
+        }
+
+    private:
+        size_t _capacity;
+        bool _is_closed{ false };
+        std::deque<T> _items{};
+
+        std::mutex _mutex{};
+        std::condition_variable _not_full{};
+        std::condition_variable _not_empty{};
+    };
+}
\ No newline at end of file
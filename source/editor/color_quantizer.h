@@ -0,0 +1,400 @@
+#pragma once
+
+#include "simple_image.h"
+#include "palette_matcher.h"
+
+namespace MPG
+{
+    // Turns truecolor images into indexed ones. Colors are counted on a 32x32x32 grid, the grid
+    // cells are split into boxes by median cut and the boxes' colors are refined with a few rounds
+    // of k-means. Pixels are then mapped to their nearest palette color with a palette_matcher.
+    // Counting and mapping are split across all cores. Alpha is ignored.
+
+    // Returns a new image of the given bit depth, with a palette of 2^bit_depth colors
+    simple_image quantize_image(image_view const& source, uint8_t bit_depth, uint32_t refine_passes = 4);
+
+    // Just the colors quantize_image would pick, without padding the palette out to 2^bit_depth
+    color_palette make_quantized_palette(image_view const& source, uint8_t bit_depth, uint32_t refine_passes = 4);
+}
+
+//#define COLOR_QUANTIZER_IMPL
+#ifdef COLOR_QUANTIZER_IMPL
+
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace MPG
+{
+    constexpr uint32_t quantizer_cell_count = 32 * 32 * 32;
+
+    // Which grid cell a color falls into, five bits per channel
+    constexpr uint32_t get_quantizer_cell(uint8_t r, uint8_t g, uint8_t b) noexcept
+    {
+        return (static_cast<uint32_t>(r >> 3) << 10) | (static_cast<uint32_t>(g >> 3) << 5) | static_cast<uint32_t>(b >> 3);
+    }
+
+    // Every color that fell into a cell, summed up so the cell's average is exact
+    struct quantizer_bin
+    {
+        uint64_t r{ 0 };
+        uint64_t g{ 0 };
+        uint64_t b{ 0 };
+        uint64_t count{ 0 };
+    };
+
+    // The average color of an occupied cell
+    struct quantizer_color
+    {
+        float r{ 0.f };
+        float g{ 0.f };
+        float b{ 0.f };
+        uint64_t count{ 0 };
+    };
+
+    // A range of occupied cells that ends up as one palette color
+    struct quantizer_box
+    {
+        size_t begin{ 0 };
+        size_t end{ 0 };
+        double error{ 0.0 };
+    };
+
+    // Splits [0, count) into one band per core and runs them side by side, the calling thread
+    // taking the first one. Bands are at least min_band long.
+    template<typename Function>
+    void run_in_bands(size_t count, size_t min_band, Function const& function)
+    {
+        auto const cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        auto const band_count = std::clamp<size_t>(count / std::max<size_t>(min_band, 1), 1, cores);
+
+        auto workers = std::vector<std::jthread>{};
+        workers.reserve(band_count - 1);
+
+        for (auto band = size_t{ 1 }; band < band_count; band++)
+        {
+            workers.emplace_back([&function, count, band, band_count]
+                {
+                    function(count * band / band_count, count * (band + 1) / band_count);
+                });
+        }
+
+        function(size_t{ 0 }, count / band_count);
+    }
+
+    template<typename Format>
+    std::vector<quantizer_bin> count_colors(typed_view<Format> const& pixels)
+    {
+        auto histogram = std::vector<quantizer_bin>(quantizer_cell_count);
+        auto histogram_mutex = std::mutex{};
+
+        run_in_bands(pixels.height, 64, [&](size_t first_row, size_t last_row)
+            {
+                auto local = std::vector<quantizer_bin>(quantizer_cell_count);
+                for (auto y = first_row; y < last_row; y++)
+                {
+                    auto pixel = pixels.row(static_cast<uint32_t>(y));
+                    for (auto x = 0u; x < pixels.width; x++, pixel += Format::bytes_per_pixel)
+                    {
+                        auto& bin = local[get_quantizer_cell(pixel[0], pixel[1], pixel[2])];
+                        bin.r += pixel[0];
+                        bin.g += pixel[1];
+                        bin.b += pixel[2];
+                        bin.count++;
+                    }
+                }
+
+                auto lock = std::scoped_lock{ histogram_mutex };
+                for (auto cell = size_t{ 0 }; cell < histogram.size(); cell++)
+                {
+                    histogram[cell].r += local[cell].r;
+                    histogram[cell].g += local[cell].g;
+                    histogram[cell].b += local[cell].b;
+                    histogram[cell].count += local[cell].count;
+                }
+            });
+
+        return histogram;
+    }
+
+    float get_channel(quantizer_color const& color, int channel) noexcept
+    {
+        return channel == 0 ? color.r : channel == 1 ? color.g : color.b;
+    }
+
+    // How far the box's colors are from their average, weighted by how often they appear
+    quantizer_box make_quantizer_box(std::vector<quantizer_color> const& colors, size_t begin, size_t end) noexcept
+    {
+        auto sum = std::array<double, 3>{};
+        auto sum_squares = 0.0;
+        auto count = 0.0;
+
+        for (auto index = begin; index < end; index++)
+        {
+            auto const& color = colors[index];
+            auto const weight = static_cast<double>(color.count);
+            sum[0] += color.r * weight;
+            sum[1] += color.g * weight;
+            sum[2] += color.b * weight;
+            sum_squares += (color.r * color.r + color.g * color.g + color.b * color.b) * weight;
+            count += weight;
+        }
+
+        auto const error = sum_squares - (sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]) / count;
+        return { begin, end, end - begin > 1 ? error : 0.0 };
+    }
+
+    // Cuts the box at the weighted median of its widest channel
+    std::pair<quantizer_box, quantizer_box> split_box(std::vector<quantizer_color>& colors, quantizer_box const& box)
+    {
+        auto low = std::array<float, 3>{ 255.f, 255.f, 255.f };
+        auto high = std::array<float, 3>{ 0.f, 0.f, 0.f };
+        auto total = uint64_t{ 0 };
+
+        for (auto index = box.begin; index < box.end; index++)
+        {
+            for (auto channel = 0; channel < 3; channel++)
+            {
+                low[channel] = std::min(low[channel], get_channel(colors[index], channel));
+                high[channel] = std::max(high[channel], get_channel(colors[index], channel));
+            }
+
+            total += colors[index].count;
+        }
+
+        auto channel = 0;
+        for (auto candidate = 1; candidate < 3; candidate++)
+        {
+            if (high[candidate] - low[candidate] > high[channel] - low[channel])
+            {
+                channel = candidate;
+            }
+        }
+
+        std::sort(colors.begin() + box.begin, colors.begin() + box.end, [channel](quantizer_color const& lhs, quantizer_color const& rhs)
+            {
+                return get_channel(lhs, channel) < get_channel(rhs, channel);
+            });
+
+        // Both halves keep at least one cell
+        auto middle = box.begin + 1;
+        auto running = colors[box.begin].count;
+        while (middle < box.end - 1 && running * 2 < total)
+        {
+            running += colors[middle].count;
+            middle++;
+        }
+
+        return { make_quantizer_box(colors, box.begin, middle), make_quantizer_box(colors, middle, box.end) };
+    }
+
+    uint8_t find_nearest_color(quantizer_color const& color, std::vector<std::array<float, 3>> const& palette) noexcept
+    {
+        auto nearest = size_t{ 0 };
+        auto nearest_distance = std::numeric_limits<float>::max();
+
+        for (auto index = size_t{ 0 }; index < palette.size(); index++)
+        {
+            auto const dr = color.r - palette[index][0];
+            auto const dg = color.g - palette[index][1];
+            auto const db = color.b - palette[index][2];
+            auto const distance = dr * dr + dg * dg + db * db;
+
+            if (distance < nearest_distance)
+            {
+                nearest = index;
+                nearest_distance = distance;
+            }
+        }
+
+        return static_cast<uint8_t>(nearest);
+    }
+
+    // Points every occupied cell at its nearest palette color
+    void assign_colors(std::vector<quantizer_color> const& colors, std::vector<std::array<float, 3>> const& palette, std::vector<uint8_t>& nearest)
+    {
+        run_in_bands(colors.size(), 1024, [&](size_t first, size_t last)
+            {
+                for (auto index = first; index < last; index++)
+                {
+                    nearest[index] = find_nearest_color(colors[index], palette);
+                }
+            });
+    }
+
+    template<typename Format>
+    void map_pixels(typed_view<Format> const& pixels, palette_matcher const& matcher, simple_image& result)
+    {
+        run_in_bands(pixels.height, 64, [&](size_t first_row, size_t last_row)
+            {
+                for (auto y = first_row; y < last_row; y++)
+                {
+                    auto pixel = pixels.row(static_cast<uint32_t>(y));
+                    auto destination = result.pixel_data.data() + y * pixels.width;
+
+                    for (auto x = 0u; x < pixels.width; x++, pixel += Format::bytes_per_pixel)
+                    {
+                        destination[x] = matcher.find(pixel[0], pixel[1], pixel[2]);
+                    }
+                }
+            });
+    }
+
+    // The palette, along with every occupied cell and the palette color it ended up nearest to
+    struct quantizer_result
+    {
+        std::vector<quantizer_color> colors{};
+        std::vector<uint8_t> nearest{};
+        std::vector<std::array<float, 3>> palette{};
+    };
+
+    template<typename Format>
+    quantizer_result quantize_colors(typed_view<Format> const& pixels, uint8_t bit_depth, uint32_t refine_passes)
+    {
+        if (bit_depth < 1 || bit_depth > 8)
+            throw std::runtime_error("Bit-depth must be between 1 and 8");
+
+        if constexpr (Format::bytes_per_pixel == 1)
+        {
+            throw std::runtime_error("Only truecolor images can be quantized.");
+        }
+        else
+        {
+            auto const histogram = count_colors(pixels);
+
+            auto result = quantizer_result{};
+            auto& colors = result.colors;
+            for (auto cell = 0u; cell < quantizer_cell_count; cell++)
+            {
+                auto const& bin = histogram[cell];
+                if (bin.count > 0)
+                {
+                    auto const count = static_cast<float>(bin.count);
+                    colors.push_back({ bin.r / count, bin.g / count, bin.b / count, bin.count });
+                }
+            }
+
+            // Median cut: keep splitting the box whose colors are furthest apart
+            auto const palette_size = size_t{ 1 } << bit_depth;
+            auto boxes = std::vector<quantizer_box>{};
+            if (!colors.empty())
+            {
+                boxes.push_back(make_quantizer_box(colors, 0, colors.size()));
+            }
+
+            while (boxes.size() < palette_size)
+            {
+                auto const worst = std::max_element(boxes.begin(), boxes.end(), [](quantizer_box const& lhs, quantizer_box const& rhs)
+                    {
+                        return lhs.error < rhs.error;
+                    });
+
+                if (worst == boxes.end() || worst->end - worst->begin < 2)
+                    break;
+
+                auto const [first, second] = split_box(colors, *worst);
+                *worst = first;
+                boxes.push_back(second);
+            }
+
+            auto& palette = result.palette;
+            auto& nearest = result.nearest;
+            palette.resize(boxes.size());
+            nearest.resize(colors.size());
+            for (auto index = size_t{ 0 }; index < boxes.size(); index++)
+            {
+                for (auto color = boxes[index].begin; color < boxes[index].end; color++)
+                {
+                    nearest[color] = static_cast<uint8_t>(index);
+                }
+            }
+
+            // k-means: move every palette color to the average of the cells nearest to it,
+            // then find the nearest colors again. The first pass starts from the boxes.
+            for (auto pass = 0u; pass <= refine_passes; pass++)
+            {
+                auto sums = std::vector<std::array<double, 4>>(palette.size());
+                for (auto index = size_t{ 0 }; index < colors.size(); index++)
+                {
+                    auto const& color = colors[index];
+                    auto& sum = sums[nearest[index]];
+                    sum[0] += static_cast<double>(color.r) * color.count;
+                    sum[1] += static_cast<double>(color.g) * color.count;
+                    sum[2] += static_cast<double>(color.b) * color.count;
+                    sum[3] += static_cast<double>(color.count);
+                }
+
+                for (auto index = size_t{ 0 }; index < palette.size(); index++)
+                {
+                    if (sums[index][3] > 0.0)
+                    {
+                        palette[index] =
+                        {
+                            static_cast<float>(sums[index][0] / sums[index][3]),
+                            static_cast<float>(sums[index][1] / sums[index][3]),
+                            static_cast<float>(sums[index][2] / sums[index][3])
+                        };
+                    }
+                }
+
+                assign_colors(colors, palette, nearest);
+            }
+
+            return result;
+        }
+    }
+
+    // The palette colors rounded to bytes, padded with black up to size
+    color_palette to_color_palette(std::vector<std::array<float, 3>> const& palette, size_t size)
+    {
+        auto colors = color_palette(std::max(size, palette.size()));
+        for (auto index = size_t{ 0 }; index < palette.size(); index++)
+        {
+            colors[index] =
+            {
+                static_cast<uint8_t>(std::lround(palette[index][0])),
+                static_cast<uint8_t>(std::lround(palette[index][1])),
+                static_cast<uint8_t>(std::lround(palette[index][2])),
+                0xFF
+            };
+        }
+
+        return colors;
+    }
+
+    simple_image quantize_image(image_view const& source, uint8_t bit_depth, uint32_t refine_passes)
+    {
+        return visit_pixels(source, [&](auto const& pixels)
+            {
+                auto const quantized = quantize_colors(pixels, bit_depth, refine_passes);
+
+                auto result = simple_image{ pixels.width, pixels.height, bit_depth };
+                result.color_palette = to_color_palette(quantized.palette, size_t{ 1 } << bit_depth);
+
+                result.pixel_data.resize(static_cast<size_t>(pixels.width) * pixels.height);
+
+                // Every pixel gets the nearest of the colors it ended up with, not just the one its cell did.
+                // The padding is left out so nothing maps to it. An empty image has no colors at all.
+                if (!quantized.palette.empty())
+                {
+                    auto const matcher = palette_matcher{ std::span{ result.color_palette }.first(quantized.palette.size()) };
+                    map_pixels(pixels, matcher, result);
+                }
+
+                return result;
+            });
+    }
+
+    color_palette make_quantized_palette(image_view const& source, uint8_t bit_depth, uint32_t refine_passes)
+    {
+        return visit_pixels(source, [&](auto const& pixels)
+            {
+                auto const quantized = quantize_colors(pixels, bit_depth, refine_passes);
+                return to_color_palette(quantized.palette, 0);
+            });
+    }
+}
+
+#endif // COLOR_QUANTIZER_IMPL
\ No newline at end of file
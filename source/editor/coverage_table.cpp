@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "coverage_table.h"
+
+namespace NEONnoir
+{
+    void coverage_table::update(MPG::image_view const& image, uint64_t generation, uint8_t background)
+    {
+        if (_background == background && _pixels == image.pixels && _generation == generation && _width == image.width && _height == image.height)
+            return;
+
+        if (image.bytes_per_pixel > 1)
+            throw std::runtime_error("Only indexed images have a coverage table.");
+
+        auto const stride = static_cast<size_t>(image.width) + 1;
+        _sums.assign(stride * (static_cast<size_t>(image.height) + 1), 0);
+
+        for (auto y = 0u; y < image.height; y++)
+        {
+            auto const row = image.row(y);
+            auto const above = _sums.data() + y * stride;
+            auto const sums = above + stride;
+
+            auto row_sum = 0u;
+            for (auto x = 0u; x < image.width; x++)
+            {
+                row_sum += row[x] != background ? 1 : 0;
+                sums[x + 1] = above[x + 1] + row_sum;
+            }
+        }
+
+        _pixels = image.pixels;
+        _generation = generation;
+        _width = image.width;
+        _height = image.height;
+        _background = background;
+    }
+
+    uint32_t coverage_table::sum(uint32_t x, uint32_t y) const noexcept
+    {
+        return _sums[static_cast<size_t>(y) * (static_cast<size_t>(_width) + 1) + x];
+    }
+
+    uint32_t coverage_table::count(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const noexcept
+    {
+        if (!_background)
+            return 0;
+
+        auto const x0 = std::min(x, _width);
+        auto const y0 = std::min(y, _height);
+        auto const x1 = x0 + std::min(width, _width - x0);
+        auto const y1 = y0 + std::min(height, _height - y0);
+
+        return sum(x1, y1) - sum(x0, y1) - sum(x1, y0) + sum(x0, y0);
+    }
+
+    MPG::pixel_rect coverage_table::bounds(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const noexcept
+    {
+        if (count(x, y, width, height) == 0)
+            return {};
+
+        auto const x0 = std::min(x, _width);
+        auto const y0 = std::min(y, _height);
+        auto const x1 = x0 + std::min(width, _width - x0);
+        auto const y1 = y0 + std::min(height, _height - y0);
+
+        // The first position where the part up to it, or from it, isn't empty anymore
+        auto const search = [](uint32_t first, uint32_t last, auto&& is_filled)
+            {
+                while (first < last)
+                {
+                    auto const middle = first + (last - first) / 2;
+                    if (is_filled(middle))
+                    {
+                        last = middle;
+                    }
+                    else
+                    {
+                        first = middle + 1;
+                    }
+                }
+
+                return first;
+            };
+
+        auto const top = search(y0, y1, [&](uint32_t row) { return count(x0, y0, x1 - x0, row + 1 - y0) > 0; });
+        auto const bottom = search(top, y1, [&](uint32_t row) { return count(x0, row + 1, x1 - x0, y1 - row - 1) == 0; }) + 1;
+        auto const left = search(x0, x1, [&](uint32_t column) { return count(x0, top, column + 1 - x0, bottom - top) > 0; });
+        auto const right = search(left, x1, [&](uint32_t column) { return count(column + 1, top, x1 - column - 1, bottom - top) == 0; }) + 1;
+
+        return { left, top, right - left, bottom - top };
+    }
+}
\ No newline at end of file
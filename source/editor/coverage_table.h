@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "sprite_slicer.h"
+
+namespace NEONnoir
+{
+    // Summed-area table of the pixels in a container's image that aren't the background, so the
+    // number of them under any rectangle takes four lookups however big the rectangle is. It's
+    // built the first time it's asked for and kept for as long as it's asked for with the same
+    // pixels, image generation and background.
+    class coverage_table
+    {
+    public:
+        // Builds the table for the image and background, unless it's already there. The generation
+        // has to change whenever the pixels do, see shape_container::image_generation. Only indexed
+        // images have one.
+        void update(MPG::image_view const& image, uint64_t generation, uint8_t background);
+
+        // Pixels in the rectangle that aren't the background, clamped to the image
+        uint32_t count(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const noexcept;
+
+        // The smallest part of the rectangle holding everything in it that isn't the background,
+        // found with a binary search on every side. Empty if there's nothing there.
+        MPG::pixel_rect bounds(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const noexcept;
+
+    private:
+        // Everything in [0, x) x [0, y)
+        uint32_t sum(uint32_t x, uint32_t y) const noexcept;
+
+    private:
+        // (width + 1) x (height + 1), the first row and column are all 0
+        std::vector<uint32_t> _sums{};
+        uint8_t const* _pixels{ nullptr };
+        uint64_t _generation{ 0 };
+        uint32_t _width{ 0 };
+        uint32_t _height{ 0 };
+        std::optional<uint8_t> _background{};
+    };
+}
@@ -7,6 +7,7 @@
 
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <filesystem>
 #include <format>
 #include <iostream>
@@ -38,6 +39,24 @@ namespace NEONnoir
 
         glfwSetWindowUserPointer(_window.get(), this);
 
+        // Only redraw when something happens. These have to be installed before ImGui's own so it
+        // chains them along.
+        auto const input_received = [](GLFWwindow* window, auto...)
+        {
+            static_cast<editor*>(glfwGetWindowUserPointer(window))->on_input();
+        };
+
+        glfwSetCursorPosCallback(_window.get(), input_received);
+        glfwSetCursorEnterCallback(_window.get(), input_received);
+        glfwSetMouseButtonCallback(_window.get(), input_received);
+        glfwSetScrollCallback(_window.get(), input_received);
+        glfwSetKeyCallback(_window.get(), input_received);
+        glfwSetCharCallback(_window.get(), input_received);
+        glfwSetWindowFocusCallback(_window.get(), input_received);
+        glfwSetWindowSizeCallback(_window.get(), input_received);
+        glfwSetWindowRefreshCallback(_window.get(), input_received);
+        glfwSetDropCallback(_window.get(), input_received);
+
         // Intitialize IMGUI
         IMGUI_CHECKVERSION();
         ImGui::CreateContext();
@@ -56,10 +75,16 @@ namespace NEONnoir
 
     editor::~editor() noexcept
     {
+        // Textures need the GL context, and the workers can still ask GLFW for a redraw until
+        // they're joined
+        _shape_editor_tool.reset();
+        free_palette_shader();
+
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
 
+        _window.reset();
         glfwTerminate();
     }
 
@@ -92,6 +117,37 @@ namespace NEONnoir
     {
         while (!glfwWindowShouldClose(_window.get()))
         {
+            // Sleep until something happens, unless something on screen is moving
+            if (_frames_to_draw > 0 || is_animating())
+            {
+                glfwPollEvents();
+            }
+            else if (_shape_editor_tool->is_watching())
+            {
+                // Watch mode needs to check on its files often enough to re-export promptly
+                glfwWaitEventsTimeout(watch_poll_seconds);
+            }
+            else
+            {
+                glfwWaitEvents();
+            }
+
+            // Waking up doesn't mean there's anything new to show. Input, a redraw request from
+            // another thread, or the tool having news are the only reasons to draw a frame.
+            auto const has_news = _shape_editor_tool->update();
+            if (consume_redraw_request() || has_news)
+            {
+                _frames_to_draw = std::max(_frames_to_draw, 1);
+            }
+
+            if (_frames_to_draw == 0 && !is_animating())
+                continue;
+
+            if (_frames_to_draw > 0)
+            {
+                _frames_to_draw--;
+            }
+
             glClear(GL_COLOR_BUFFER_BIT);
 
             ImGui_ImplOpenGL3_NewFrame();
@@ -102,7 +158,7 @@ namespace NEONnoir
 
             //process_main_menu();
 
-            _shape_editor_tool.display();
+            _shape_editor_tool->display();
 
             if (_show_error_popup)
             {
@@ -128,14 +184,53 @@ namespace NEONnoir
                 }
             }
 
+            if (ImGui::IsKeyPressed(ImGuiKey_F12, false))
+            {
+                _show_stats = !_show_stats;
+            }
+
+            if (_show_stats)
+            {
+                _cpu_usage.update();
+                display_stats();
+            }
+
             ImGui::Render();
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
             glfwSwapBuffers(_window.get());
-            glfwPollEvents();
         }
     }
 
+    bool editor::is_animating() const noexcept
+    {
+        // Keep drawing for as long as something is being dragged around. Everything else asks
+        // for a redraw when it has something to show.
+        auto const& io = ImGui::GetIO();
+        for (auto const is_down : io.MouseDown)
+        {
+            if (is_down)
+                return true;
+        }
+
+        return false;
+    }
+
+    void editor::display_stats() const
+    {
+        auto const stats = std::format("CPU {:.1f}%  {:.0f} fps", _cpu_usage.cpu_percent(), _cpu_usage.frames_per_second());
+
+        auto const viewport = ImGui::GetMainViewport();
+        auto const size = ImGui::CalcTextSize(stats.c_str());
+        auto const position = ImVec2
+        {
+            viewport->Pos.x + viewport->Size.x - size.x - 8.f,
+            viewport->Pos.y + viewport->Size.y - size.y - 4.f
+        };
+
+        ImGui::GetForegroundDrawList()->AddText(position, IM_COL32(255, 255, 255, 128), stats.c_str());
+    }
+
     void editor::save_project()
     {
     }
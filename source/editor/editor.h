@@ -4,6 +4,7 @@
 #include <memory>
 
 #include "shape_editor_tool.h"
+#include "utils.h"
 
 struct ImFont;
 
@@ -31,13 +32,28 @@ namespace NEONnoir
     private:
         void save_project();
 
+        // Any input means ImGui needs a few frames to settle (hover states, popups, etc.)
+        void on_input() noexcept { _frames_to_draw = 3; }
+        bool is_animating() const noexcept;
+        void display_stats() const;
+
+        // How often watch mode gets to look at its files when nothing else is going on
+        static constexpr double watch_poll_seconds = 0.1;
+
     private:
         GLFWwindow_ptr _window;
         ImFont* _ui_font;
         float _dpi_scale_x;
         float _dpi_scale_y;
 
-        shape_editor_tool _shape_editor_tool{};
+        // Owns textures and worker threads, so it's torn down first, while there's still a context
+        std::unique_ptr<shape_editor_tool> _shape_editor_tool{ std::make_unique<shape_editor_tool>() };
+
+        int32_t _frames_to_draw{ 3 };
+
+        // F12 shows how busy the editor is, for debugging the redraws
+        bool _show_stats{ false };
+        cpu_usage_meter _cpu_usage{};
 
         bool _show_error_popup{ false };
         std::string _error_message{};
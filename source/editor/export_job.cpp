@@ -0,0 +1,185 @@
+#include <chrono>
+#include <format>
+
+#include "glfw_utils.h"
+#include "export_job.h"
+#include "export_pipeline.h"
+
+namespace NEONnoir
+{
+    export_job::export_job(file_format format, std::filesystem::path const& file_path, std::vector<shape_container>&& snapshot, uint8_t bit_depth, MPG::dither_mode dither, bool shared_palette, std::optional<shape_cache> cache, std::optional<export_state> previous)
+        : _format{ format },
+        _file_path{ file_path },
+        _snapshot{ std::move(snapshot) },
+        _bit_depth{ bit_depth },
+        _dither{ dither },
+        _is_palette_shared{ shared_palette },
+        _cache{ std::move(cache) },
+        _previous{ std::move(previous) },
+        _worker{ [this](std::stop_token stop) { run(stop); } }
+    {
+    }
+
+    export_job::~export_job() noexcept
+    {
+        // The worker is joined when it goes out of scope
+        cancel();
+    }
+
+    std::shared_ptr<export_state::converted_container const> export_state::find(size_t index, shape_container const& container, uint8_t bit_depth, MPG::dither_mode dither) const
+    {
+        if (bit_depth != this->bit_depth || dither != this->dither || index >= containers.size())
+            return nullptr;
+
+        auto const& converted = containers[index];
+        if (!converted || converted->image_generation != container.image_generation || converted->shapes != container.shapes)
+            return nullptr;
+
+        return converted;
+    }
+
+    void export_job::get() const
+    {
+        if (_is_done && _error)
+        {
+            std::rethrow_exception(_error);
+        }
+    }
+
+    std::string export_job::describe_stages() const
+    {
+        auto description = std::string{};
+        for (auto index = size_t{ 0 }; index < _control.stages.size(); index++)
+        {
+            auto const& stage = _control.stages[index];
+            auto const busy = stage.busy_us.load();
+            auto const total = busy + stage.idle_us.load();
+
+            description += std::format("{}{}: {:.0f}% busy", index > 0 ? ", " : "", export_stage_names[index], total > 0 ? busy * 100.0 / total : 0.0);
+        }
+
+        return description;
+    }
+
+    void export_job::run(std::stop_token stop)
+    {
+        _control.stop = stop;
+
+        // The progress bar only needs to keep up with what the eye can see
+        _control.on_progress = [this]
+            {
+                auto const now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                auto last = _last_progress_ms.load();
+                if (now - last >= 50 && _last_progress_ms.compare_exchange_strong(last, now))
+                {
+                    request_redraw();
+                }
+            };
+
+        auto const cache = _cache ? &_cache.value() : nullptr;
+
+        try
+        {
+            if (_previous && _format == file_format::mpsh)
+            {
+                run_incremental(cache);
+            }
+            else
+            {
+                // Every image has to be looked at once before the palette is known
+                if (_is_palette_shared)
+                {
+                    _palette = unify_container_palettes(_snapshot, _bit_depth, _dither, &_control);
+                }
+
+                auto const palette = _palette ? &_palette.value() : nullptr;
+                switch (_format)
+                {
+                case file_format::mpsh:
+                    save_shape_mpsh(_file_path, _snapshot, _bit_depth, _dither, palette, cache, &_control);
+                    break;
+
+                case file_format::blitz:
+                    save_shape_blitz(_file_path, _snapshot, _bit_depth, _dither, palette, cache, &_control);
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            _error = std::current_exception();
+        }
+
+        _is_done = true;
+        request_redraw();
+    }
+
+    void export_job::run_incremental(shape_cache const* cache)
+    {
+        if (_is_palette_shared)
+        {
+            _palette = unify_container_palettes(_snapshot, _bit_depth, _dither, &_control);
+        }
+
+        // A new shared palette changes every shape, nothing can be reused then
+        auto const& previous = _previous.value();
+        auto const is_palette_same = previous.palette == _palette;
+
+        auto state = export_state{ _bit_depth, _dither, _palette };
+        state.containers.resize(_snapshot.size());
+
+        // Only the containers that changed go through the pipeline
+        auto changed = std::vector<shape_container>{};
+        auto changed_indices = std::vector<size_t>{};
+        for (auto index = size_t{ 0 }; index < _snapshot.size(); index++)
+        {
+            if (is_palette_same)
+            {
+                state.containers[index] = previous.find(index, _snapshot[index], _bit_depth, _dither);
+                if (state.containers[index])
+                    continue;
+            }
+
+            changed_indices.push_back(index);
+            changed.push_back(std::move(_snapshot[index]));
+        }
+
+        auto converted = std::vector<std::shared_ptr<export_state::converted_container>>{};
+        for (auto const& container : changed)
+        {
+            auto& entry = converted.emplace_back(std::make_shared<export_state::converted_container>());
+            entry->image_generation = container.image_generation;
+            entry->shapes = container.shapes;
+            entry->blobs.reserve(container.shapes.size());
+        }
+
+        // Shapes come out in order, fill up the containers one after the other
+        _control.shapes_total = count_shapes(changed);
+
+        auto current = size_t{ 0 };
+        auto const palette = _palette ? &_palette.value() : nullptr;
+        run_export_pipeline(changed, _bit_depth, _dither, palette, cache, &_control, [&](MPG::pixel_data const& blob)
+            {
+                while (converted[current]->blobs.size() == changed[current].shapes.size())
+                {
+                    current++;
+                }
+
+                converted[current]->blobs.push_back(blob);
+            });
+
+        for (auto index = size_t{ 0 }; index < converted.size(); index++)
+        {
+            state.containers[changed_indices[index]] = std::move(converted[index]);
+        }
+
+        auto containers = std::vector<std::span<MPG::pixel_data const>>{};
+        for (auto const& container : state.containers)
+        {
+            containers.push_back(container->blobs);
+        }
+
+        write_mpsh(_file_path, containers, &_control);
+        _state = std::move(state);
+    }
+}
\ No newline at end of file
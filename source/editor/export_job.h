@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shapes.h"
+#include "shape_cache.h"
+
+namespace NEONnoir
+{
+    // What an MPSH export converted, kept around so the next export of the same project only has
+    // to convert the containers that changed
+    struct export_state
+    {
+        // The shapes of one container and what they were converted from
+        struct converted_container
+        {
+            uint64_t image_generation{};
+            std::vector<shape> shapes{};
+            std::vector<MPG::pixel_data> blobs{};
+        };
+
+        uint8_t bit_depth{ 0 };
+        MPG::dither_mode dither{ MPG::dither_mode::none };
+        std::optional<MPG::unified_palette> palette{};
+        std::vector<std::shared_ptr<converted_container const>> containers{};
+
+        // What was converted for the container at that index last time, if neither its image, its
+        // shapes nor the settings changed since. The palette is checked by the export itself.
+        std::shared_ptr<converted_container const> find(size_t index, shape_container const& container, uint8_t bit_depth, MPG::dither_mode dither) const;
+    };
+
+    // Exports shapes on a background thread. The job works on its own snapshot of the containers,
+    // so they can keep being edited while it runs. Cancelling it leaves no partial file behind.
+    class export_job
+    {
+    public:
+        enum class file_format
+        {
+            mpsh,
+            blitz,
+        };
+
+        // The snapshot must not hold on to any textures, they can only be released on the UI thread.
+        // Containers without pixels have their images decoded as part of the export. With a shared
+        // palette, all the containers' colors are gathered into one before anything is converted.
+        //
+        // Given what a previous MPSH export converted, the containers that haven't changed since
+        // are written from that and only the others go through the pipeline. Those are the only
+        // ones that need pixels in the snapshot, unless the palette is shared.
+        export_job(file_format format, std::filesystem::path const& file_path, std::vector<shape_container>&& snapshot, uint8_t bit_depth, MPG::dither_mode dither, bool shared_palette, std::optional<shape_cache> cache, std::optional<export_state> previous = std::nullopt);
+        ~export_job() noexcept;
+
+        export_job(export_job const&) = delete;
+        export_job& operator=(export_job const&) = delete;
+
+        void cancel() noexcept { _worker.request_stop(); }
+
+        bool is_done() const noexcept { return _is_done; }
+
+        // Once the job is done, rethrows whatever made it fail, if anything
+        void get() const;
+
+        std::filesystem::path const& file_path() const noexcept { return _file_path; }
+        size_t shapes_total() const noexcept { return _control.shapes_total; }
+        size_t shapes_converted() const noexcept { return _control.shapes_converted; }
+        uint64_t bytes_written() const noexcept { return _control.bytes_written; }
+
+        // The palette all the shapes were moved onto, once the job is done, if it made one
+        MPG::unified_palette const* shared_palette() const noexcept { return _is_done && _palette ? &_palette.value() : nullptr; }
+
+        // What this export converted, once the job is done, if it was given a previous state
+        export_state const* state() const noexcept { return _is_done && _state ? &_state.value() : nullptr; }
+
+        // How busy each stage of the export has been so far, to tell where the bottleneck is
+        std::string describe_stages() const;
+
+    private:
+        void run(std::stop_token stop);
+        void run_incremental(shape_cache const* cache);
+
+    private:
+        file_format _format;
+        std::filesystem::path _file_path;
+        std::vector<shape_container> _snapshot;
+        uint8_t _bit_depth;
+        MPG::dither_mode _dither;
+        bool _is_palette_shared;
+        std::optional<shape_cache> _cache;
+        std::optional<MPG::unified_palette> _palette{};
+        std::optional<export_state> _previous;
+        std::optional<export_state> _state{};
+
+        export_control _control{};
+        std::atomic<int64_t> _last_progress_ms{ 0 };
+        std::exception_ptr _error{};
+        std::atomic<bool> _is_done{ false };
+
+        std::jthread _worker{};
+    };
+}
\ No newline at end of file
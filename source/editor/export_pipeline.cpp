@@ -0,0 +1,400 @@
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "export_pipeline.h"
+#include "shape_cache.h"
+#include "thread_pool.h"
+
+namespace NEONnoir
+{
+    // How far ahead each stage is allowed to get
+    constexpr size_t loaded_capacity = 1;       // Images
+    constexpr size_t clamped_capacity = 1;      // Images
+    constexpr size_t cropped_capacity = 64;     // Shapes
+    constexpr size_t converted_capacity = 64;   // Shapes
+
+    // Shapes can be planarized out of order, but never more than this many past the next one to be
+    // written, or a single slow shape would have everything after it pile up in the writer
+    constexpr size_t reorder_window = cropped_capacity + converted_capacity;
+
+    // A decoded source image
+    struct loaded_container
+    {
+        size_t container_index{};
+        std::shared_ptr<MPG::simple_image const> image{};
+    };
+
+    // A source image along with its palette clamped version, which is only made if a shape needs it.
+    // Shapes that get dithered are cropped straight from the source image instead.
+    struct clamped_container
+    {
+        size_t container_index{};
+        size_t first_sequence{};
+        std::shared_ptr<MPG::simple_image const> image{};
+        std::optional<MPG::simple_image> clamped{};
+        bool dithering{ false };
+        std::vector<uint64_t> keys{};
+        std::vector<std::optional<MPG::pixel_data>> cached{};
+    };
+
+    // A single shape on its way through. Shapes found in the cache skip straight to the writer.
+    struct shape_work
+    {
+        size_t sequence{};
+        uint64_t key{};
+        std::shared_ptr<clamped_container const> container{};      // Keeps the cropped pixels alive
+        std::optional<MPG::image_view> cropped{};
+        shape region{};
+        MPG::pixel_data blob{};
+    };
+
+    // Adds the time since the last mark to either the busy or the idle total of a stage
+    class stage_timer
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        explicit stage_timer(export_stage_stats& stats) : _stats{ stats } {}
+
+        void busy() noexcept { _stats.busy_us += lap(); }
+        void idle() noexcept { _stats.idle_us += lap(); }
+
+    private:
+        uint64_t lap() noexcept
+        {
+            auto const now = clock::now();
+            auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - _mark).count();
+            _mark = now;
+
+            return static_cast<uint64_t>(elapsed);
+        }
+
+    private:
+        export_stage_stats& _stats;
+        clock::time_point _mark{ clock::now() };
+    };
+
+    // Holds back the shapes that are too far ahead of the writer
+    class sequence_window
+    {
+    public:
+        explicit sequence_window(size_t size) : _size{ size } {}
+
+        // Blocks until the shape is close enough to the next one to be written. Returns false if
+        // the window was aborted in the meantime.
+        bool wait_for(size_t sequence)
+        {
+            auto lock = std::unique_lock{ _mutex };
+            _moved.wait(lock, [&] { return _is_aborted || sequence < _next + _size; });
+
+            return !_is_aborted;
+        }
+
+        void advance(size_t next)
+        {
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                _next = next;
+            }
+
+            _moved.notify_all();
+        }
+
+        void abort()
+        {
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                _is_aborted = true;
+            }
+
+            _moved.notify_all();
+        }
+
+    private:
+        size_t _size;
+        size_t _next{ 0 };
+        bool _is_aborted{ false };
+
+        std::mutex _mutex{};
+        std::condition_variable _moved{};
+    };
+
+    void run_export_pipeline(std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette, shape_cache const* cache, export_control* control, std::function<void(MPG::pixel_data const&)> const& write_shape)
+    {
+        auto local_control = export_control{};
+        auto& ctl = control ? *control : local_control;
+
+        auto loaded = bounded_queue<loaded_container>{ loaded_capacity };
+        auto clamped = bounded_queue<std::shared_ptr<clamped_container const>>{ clamped_capacity };
+        auto cropped = bounded_queue<shape_work>{ cropped_capacity };
+        auto converted = bounded_queue<shape_work>{ converted_capacity };
+        auto window = sequence_window{ reorder_window };
+
+        // The first stage to fail stops everything
+        auto error_mutex = std::mutex{};
+        auto error = std::exception_ptr{};
+        auto const fail = [&]
+        {
+            {
+                auto lock = std::scoped_lock{ error_mutex };
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+
+            loaded.abort();
+            clamped.abort();
+            cropped.abort();
+            converted.abort();
+            window.abort();
+        };
+
+        auto const load_stage = [&]
+        {
+            auto timer = stage_timer{ ctl.get_stage(export_stage::load) };
+
+            try
+            {
+                for (auto index = size_t{ 0 }; index < shapes.size(); index++)
+                {
+                    ctl.check_cancelled();
+
+                    // Borrow the image if it's already in memory
+                    auto const& container = shapes[index];
+                    auto image = container.image.pixel_data.empty()
+                        ? std::make_shared<MPG::simple_image const>(MPG::load_image(container.image_file))
+                        : std::shared_ptr<MPG::simple_image const>{ std::shared_ptr<void>{}, &container.image };
+
+                    // Truecolor images need a palette before anything else can happen to them
+                    if (auto prepared = prepare_container_image(*image, bit_depth, dither, palette))
+                    {
+                        image = std::make_shared<MPG::simple_image const>(std::move(prepared.value()));
+                    }
+                    timer.busy();
+
+                    auto const pushed = loaded.push({ index, std::move(image) });
+                    timer.idle();
+
+                    if (!pushed)
+                        return;
+                }
+
+                loaded.close();
+            }
+            catch (...)
+            {
+                fail();
+            }
+        };
+
+        auto const clamp_stage = [&]
+        {
+            auto timer = stage_timer{ ctl.get_stage(export_stage::clamp) };
+
+            try
+            {
+                auto sequence = size_t{ 0 };
+                while (auto next = loaded.pop())
+                {
+                    timer.idle();
+                    ctl.check_cancelled();
+
+                    auto const& container = shapes[next->container_index];
+                    auto work = std::make_shared<clamped_container>();
+                    work->container_index = next->container_index;
+                    work->first_sequence = sequence;
+                    work->image = std::move(next->image);
+                    work->dithering = dither != MPG::dither_mode::none && MPG::loses_colors(*work->image, bit_depth);
+
+                    // Clamping the palette touches the whole image, only do it if a shape actually needs converting
+                    auto needs_clamping = false;
+                    for (auto const& shape : container.shapes)
+                    {
+                        auto const key = cache ? shape_cache_key(*work->image, shape, bit_depth, dither) : 0;
+                        work->keys.push_back(key);
+                        work->cached.push_back(cache ? cache->find(key) : std::nullopt);
+                        needs_clamping |= !work->cached.back().has_value();
+                    }
+
+                    if (needs_clamping && !work->dithering)
+                    {
+                        work->clamped = MPG::crop_palette(*work->image, bit_depth, 0);
+                    }
+
+                    sequence += container.shapes.size();
+                    timer.busy();
+
+                    auto const pushed = clamped.push(std::move(work));
+                    timer.idle();
+
+                    if (!pushed)
+                        return;
+                }
+
+                clamped.close();
+            }
+            catch (...)
+            {
+                fail();
+            }
+        };
+
+        auto const crop_stage = [&]
+        {
+            auto timer = stage_timer{ ctl.get_stage(export_stage::crop) };
+
+            try
+            {
+                while (auto next = clamped.pop())
+                {
+                    timer.idle();
+
+                    auto const& work = *next.value();
+                    auto const& container = shapes[work.container_index];
+
+                    for (auto index = size_t{ 0 }; index < container.shapes.size(); index++)
+                    {
+                        ctl.check_cancelled();
+
+                        auto shape = shape_work{ work.first_sequence + index, work.keys[index] };
+                        if (work.cached[index])
+                        {
+                            shape.blob = work.cached[index].value();
+                        }
+                        else
+                        {
+                            auto const& region = container.shapes[index];
+                            shape.container = next.value();
+                            auto const& source = work.dithering ? *work.image : work.clamped.value();
+                            shape.cropped = MPG::crop(source, region.x, region.y, region.width, region.height);
+                            shape.region = region;
+                        }
+                        timer.busy();
+
+                        auto const pushed = window.wait_for(shape.sequence) && cropped.push(std::move(shape));
+                        timer.idle();
+
+                        if (!pushed)
+                            return;
+                    }
+                }
+
+                cropped.close();
+            }
+            catch (...)
+            {
+                fail();
+            }
+        };
+
+        // Planarizing is where the actual work is, it gets all the cores the other stages don't use
+        auto const planarize_count = std::max(thread_pool::default_thread_count(), size_t{ 4 }) - 3;
+        auto planarizers_left = std::atomic<size_t>{ planarize_count };
+
+        auto const planarize_stage = [&]
+        {
+            auto timer = stage_timer{ ctl.get_stage(export_stage::planarize) };
+
+            try
+            {
+                while (auto next = cropped.pop())
+                {
+                    timer.idle();
+                    ctl.check_cancelled();
+
+                    auto& shape = next.value();
+                    if (shape.cropped)
+                    {
+                        shape.blob = shape.container->dithering
+                            ? convert_shape(MPG::reduce_bit_depth(shape.cropped.value(), bit_depth, dither), shape.region)
+                            : convert_shape(shape.cropped.value(), shape.region);
+                        shape.cropped = std::nullopt;
+                        shape.container = nullptr;
+
+                        if (cache)
+                        {
+                            cache->store(shape.key, shape.blob);
+                        }
+                    }
+
+                    ctl.shape_converted();
+                    timer.busy();
+
+                    auto const pushed = converted.push(std::move(shape));
+                    timer.idle();
+
+                    if (!pushed)
+                        return;
+                }
+
+                // The last one out lets the writer know
+                if (--planarizers_left == 0)
+                {
+                    converted.close();
+                }
+            }
+            catch (...)
+            {
+                fail();
+            }
+        };
+
+        {
+            // Every stage gets a thread of its own. Declared after everything the stages use, so
+            // they're all done before any of it goes away.
+            auto pool = thread_pool{ 3 + planarize_count };
+            pool.submit(load_stage);
+            pool.submit(clamp_stage);
+            pool.submit(crop_stage);
+            for (auto index = size_t{ 0 }; index < planarize_count; index++)
+            {
+                pool.submit(planarize_stage);
+            }
+
+            // Planarizers finish out of order, hold on to shapes until it's their turn. The window
+            // keeps them all within reach of the next one to be written.
+            auto timer = stage_timer{ ctl.get_stage(export_stage::write) };
+            auto waiting = std::vector<std::optional<MPG::pixel_data>>(reorder_window);
+            auto next_sequence = size_t{ 0 };
+
+            try
+            {
+                while (auto next = converted.pop())
+                {
+                    timer.idle();
+
+                    waiting[next->sequence % reorder_window] = std::move(next->blob);
+
+                    auto const first_sequence = next_sequence;
+                    for (; waiting[next_sequence % reorder_window]; next_sequence++)
+                    {
+                        auto& ready = waiting[next_sequence % reorder_window];
+                        write_shape(ready.value());
+                        ready = std::nullopt;
+                    }
+
+                    if (next_sequence != first_sequence)
+                    {
+                        window.advance(next_sequence);
+                    }
+                    timer.busy();
+                }
+            }
+            catch (...)
+            {
+                fail();
+            }
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
\ No newline at end of file
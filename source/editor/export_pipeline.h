@@ -0,0 +1,24 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+#include "shapes.h"
+
+namespace NEONnoir
+{
+    // Converts every shape of every container as a pipeline of stages connected by bounded queues:
+    //
+    //   load -> clamp -> crop -> planarize (one per spare core) -> write
+    //
+    // so the next container is decoded while the shapes of the previous one are being converted
+    // and written. The queues are kept short, which caps how many images and shapes are in memory
+    // at once. Containers without pixels are decoded from their image file, truecolor images are
+    // quantized to the bit depth and, given a shared palette, images are moved onto it as they're
+    // loaded. When dithering, indexed shapes are dithered one by one as they're planarized instead
+    // of having the whole image clamped.
+    //
+    // write_shape is called on the calling thread with every shape, in order, so the output is the
+    // same as converting them one after the other. The time each stage spends busy and idle is
+    // added up in the control, if there is one.
+    void run_export_pipeline(std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette, shape_cache const* cache, export_control* control, std::function<void(MPG::pixel_data const&)> const& write_shape);
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include <set>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "file_watcher.h"
+
+namespace fs = std::filesystem;
+
+namespace NEONnoir
+{
+    fs::file_time_type get_last_write_time(fs::path const& path) noexcept
+    {
+        auto ec = std::error_code{};
+        auto const time = fs::last_write_time(path, ec);
+        return ec ? fs::file_time_type::min() : time;
+    }
+
+    file_watcher::file_watcher(std::chrono::milliseconds debounce)
+        : _debounce{ debounce }
+    {
+#ifdef __linux__
+        _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    file_watcher::~file_watcher() noexcept
+    {
+        clear();
+
+#ifdef __linux__
+        if (_inotify_fd >= 0)
+        {
+            close(_inotify_fd);
+        }
+#endif
+    }
+
+    void file_watcher::watch(std::vector<std::filesystem::path> const& files)
+    {
+        clear();
+
+        auto directories = std::set<fs::path>{};
+        for (auto const& file : files)
+        {
+            auto path = fs::absolute(file).lexically_normal();
+            directories.insert(path.parent_path());
+            _files.push_back({ path, get_last_write_time(path) });
+        }
+
+#ifdef __linux__
+        if (_inotify_fd >= 0)
+        {
+            for (auto const& directory : directories)
+            {
+                auto const descriptor = inotify_add_watch(_inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+                if (descriptor >= 0)
+                {
+                    _directories[descriptor] = directory;
+                }
+            }
+        }
+#endif
+    }
+
+    void file_watcher::clear() noexcept
+    {
+#ifdef __linux__
+        for (auto const& [descriptor, directory] : _directories)
+        {
+            inotify_rm_watch(_inotify_fd, descriptor);
+        }
+#endif
+
+        _directories.clear();
+        _files.clear();
+    }
+
+    std::vector<std::filesystem::path> file_watcher::poll()
+    {
+        auto const now = clock::now();
+
+        if (_inotify_fd >= 0)
+        {
+            read_events(now);
+        }
+        else
+        {
+            scan(now);
+        }
+
+        auto settled = std::vector<fs::path>{};
+        for (auto& file : _files)
+        {
+            if (file.changed_at && now - file.changed_at.value() >= _debounce)
+            {
+                file.changed_at = std::nullopt;
+                settled.push_back(file.path);
+            }
+        }
+
+        return settled;
+    }
+
+    void file_watcher::read_events([[maybe_unused]] clock::time_point now)
+    {
+#ifdef __linux__
+        alignas(inotify_event) char buffer[4096];
+
+        while (true)
+        {
+            auto const length = read(_inotify_fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+
+            for (auto offset = 0l; offset < length;)
+            {
+                auto const event = reinterpret_cast<inotify_event const*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                auto const directory = _directories.find(event->wd);
+                if (directory == _directories.end() || event->len == 0)
+                    continue;
+
+                mark_changed(directory->second / event->name, now);
+            }
+        }
+#endif
+    }
+
+    void file_watcher::scan(clock::time_point now)
+    {
+        for (auto& file : _files)
+        {
+            auto const last_write_time = get_last_write_time(file.path);
+            if (last_write_time != file.last_write_time)
+            {
+                file.last_write_time = last_write_time;
+                file.changed_at = now;
+            }
+        }
+    }
+
+    void file_watcher::mark_changed(std::filesystem::path const& path, clock::time_point now)
+    {
+        for (auto& file : _files)
+        {
+            if (file.path == path)
+            {
+                file.changed_at = now;
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace NEONnoir
+{
+    // Watches a set of files and reports the ones that changed, once their writes have settled.
+    // On Linux this sits on top of inotify (watching the parent directories so that the
+    // write-to-temp-then-rename dance most paint programs do is caught too). Everywhere else it
+    // falls back to comparing modification times every time it's polled.
+    class file_watcher
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        explicit file_watcher(std::chrono::milliseconds debounce = std::chrono::milliseconds{ 30 });
+        ~file_watcher() noexcept;
+
+        file_watcher(file_watcher const&) = delete;
+        file_watcher& operator=(file_watcher const&) = delete;
+
+        // Replaces the set of watched files
+        void watch(std::vector<std::filesystem::path> const& files);
+        void clear() noexcept;
+
+        bool is_watching() const noexcept { return !_files.empty(); }
+
+        // Non-blocking. Returns the files that changed and have then been quiet for at least the
+        // debounce interval, so a burst of writes is only reported once.
+        std::vector<std::filesystem::path> poll();
+
+    private:
+        struct watched_file
+        {
+            std::filesystem::path path;
+            std::filesystem::file_time_type last_write_time{};
+            std::optional<clock::time_point> changed_at{ std::nullopt };
+        };
+
+        void read_events(clock::time_point now);
+        void scan(clock::time_point now);
+        void mark_changed(std::filesystem::path const& path, clock::time_point now);
+
+    private:
+        std::chrono::milliseconds _debounce;
+        std::vector<watched_file> _files{};
+
+        int _inotify_fd{ -1 };
+        std::unordered_map<int, std::filesystem::path> _directories{};
+    };
+}
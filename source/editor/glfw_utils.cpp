@@ -1,23 +1,62 @@
 #define SIMPLE_IMAGE_IMPL
 #include "simple_image.h"
+#define IMAGE_TRANSFORM_IMPL
+#include "image_transform.h"
+#define PALETTE_MATCHER_IMPL
+#include "palette_matcher.h"
+#define UNIFIED_PALETTE_IMPL
+#include "unified_palette.h"
+#define SPRITE_SLICER_IMPL
+#include "sprite_slicer.h"
+#define COLOR_QUANTIZER_IMPL
+#include "color_quantizer.h"
+#define IMAGE_DITHER_IMPL
+#include "image_dither.h"
+
+#include <glad/gl.h>
+#include <array>
+#include <atomic>
 
 #include "glfw_utils.h"
 
 namespace NEONnoir
 {
+    constexpr auto palette_size = 256;
+
+    std::atomic<bool> redraw_requested{ false };
+
+    void request_redraw() noexcept
+    {
+        redraw_requested = true;
+        glfwPostEmptyEvent();
+    }
+
+    bool consume_redraw_request() noexcept
+    {
+        return redraw_requested.exchange(false);
+    }
+
+    GLuint create_palette_texture(std::span<MPG::rgba_color const> palette)
+    {
+        auto palette_id = GLuint{};
+        glGenTextures(1, &palette_id);
+        glBindTexture(GL_TEXTURE_2D, palette_id);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, palette_size, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        update_palette_texture(palette_id, palette);
+
+        return palette_id;
+    }
+
     GLtexture load_texture(MPG::simple_image const& image)
     {
         auto texture = GLtexture{};
         texture.width = image.width;
         texture.height = image.height;
 
-        // Depalettize the image if needed
-        auto depalettized = MPG::simple_image{ image };
-        if (depalettized.bit_depth < 24)
-        {
-            depalettized = MPG::depalettize_image(depalettized);
-        }
-
         // Create a OpenGL texture identifier
         glGenTextures(1, &texture.texture_id);
         glBindTexture(GL_TEXTURE_2D, texture.texture_id);
@@ -25,15 +64,217 @@ namespace NEONnoir
         // Setup filtering parameters for display
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        
+
+        // Rows of indexed and 24-bit images aren't necessarily 4-byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
         // Upload pixels into texture
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, depalettized.pixel_data.data());
+        if (image.bit_depth <= 8)
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, texture.width, texture.height, 0, GL_RED, GL_UNSIGNED_BYTE, image.pixel_data.data());
+            texture.palette_id = create_palette_texture(image.color_palette);
+        }
+        else if (image.bit_depth == 24)
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixel_data.data());
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixel_data.data());
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
         return texture;
     }
 
+    void update_texture_palette(GLtexture const& texture, std::span<MPG::rgba_color const> palette)
+    {
+        if (texture.palette_id != 0)
+        {
+            update_palette_texture(texture.palette_id, palette);
+        }
+    }
+
+    void update_palette_texture(GLuint palette_id, std::span<MPG::rgba_color const> palette)
+    {
+        // Unused entries are left black
+        auto colors = std::array<MPG::rgba_color, palette_size>{};
+        std::copy_n(palette.begin(), std::min<size_t>(palette.size(), palette_size), colors.begin());
+
+        glBindTexture(GL_TEXTURE_2D, palette_id);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, palette_size, 1, GL_RGBA, GL_UNSIGNED_BYTE, colors.data());
+    }
+
     void free_texture(GLtexture& texture)
     {
         glDeleteTextures(1, &texture.texture_id);
+
+        if (texture.palette_id != 0)
+        {
+            glDeleteTextures(1, &texture.palette_id);
+        }
+    }
+
+    // Draws like ImGui's own shader, but looks the color up in the palette texture
+    struct palette_shader
+    {
+        GLuint program{};
+        GLint projection{};
+        GLint indices{};
+        GLint palette{};
+    };
+
+    // Made the first time something is drawn with a palette, released by free_palette_shader
+    palette_shader shared_palette_shader{};
+
+    GLuint compile_shader(GLenum type, char const* source)
+    {
+        auto const shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+
+        auto status = GLint{};
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (status == GL_FALSE)
+        {
+            char log[512]{};
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            glDeleteShader(shader);
+            throw std::runtime_error{ std::string{ "Could not compile the palette shader: " } + log };
+        }
+
+        return shader;
+    }
+
+    palette_shader create_palette_shader(GLuint imgui_program)
+    {
+        char const* const vertex_source =
+            "#version 330 core\n"
+            "in vec2 Position;\n"
+            "in vec2 UV;\n"
+            "in vec4 Color;\n"
+            "uniform mat4 ProjMtx;\n"
+            "out vec2 Frag_UV;\n"
+            "out vec4 Frag_Color;\n"
+            "void main()\n"
+            "{\n"
+            "    Frag_UV = UV;\n"
+            "    Frag_Color = Color;\n"
+            "    gl_Position = ProjMtx * vec4(Position.xy, 0, 1);\n"
+            "}\n";
+
+        char const* const fragment_source =
+            "#version 330 core\n"
+            "in vec2 Frag_UV;\n"
+            "in vec4 Frag_Color;\n"
+            "uniform sampler2D Indices;\n"
+            "uniform sampler2D Palette;\n"
+            "layout (location = 0) out vec4 Out_Color;\n"
+            "void main()\n"
+            "{\n"
+            "    int index = int(texture(Indices, Frag_UV.st).r * 255.0 + 0.5);\n"
+            "    Out_Color = Frag_Color * texelFetch(Palette, ivec2(index, 0), 0);\n"
+            "}\n";
+
+        auto const vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_source);
+        auto const fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+
+        auto shader = palette_shader{};
+        shader.program = glCreateProgram();
+        glAttachShader(shader.program, vertex_shader);
+        glAttachShader(shader.program, fragment_shader);
+
+        // The vertex layout is set up by ImGui's backend, so the attributes have to end up where it expects them
+        for (auto const attribute : { "Position", "UV", "Color" })
+        {
+            glBindAttribLocation(shader.program, glGetAttribLocation(imgui_program, attribute), attribute);
+        }
+
+        glLinkProgram(shader.program);
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+
+        auto status = GLint{};
+        glGetProgramiv(shader.program, GL_LINK_STATUS, &status);
+        if (status == GL_FALSE)
+        {
+            char log[512]{};
+            glGetProgramInfoLog(shader.program, sizeof(log), nullptr, log);
+            glDeleteProgram(shader.program);
+            throw std::runtime_error{ std::string{ "Could not link the palette shader: " } + log };
+        }
+
+        shader.projection = glGetUniformLocation(shader.program, "ProjMtx");
+        shader.indices = glGetUniformLocation(shader.program, "Indices");
+        shader.palette = glGetUniformLocation(shader.program, "Palette");
+
+        return shader;
+    }
+
+    // Draw callback, runs while ImGui's backend is rendering with its own program bound
+    void bind_palette_shader(ImDrawList const*, ImDrawCmd const* command)
+    {
+        auto imgui_program = GLint{};
+        glGetIntegerv(GL_CURRENT_PROGRAM, &imgui_program);
+
+        if (shared_palette_shader.program == 0)
+        {
+            shared_palette_shader = create_palette_shader(imgui_program);
+        }
+        auto const& shader = shared_palette_shader;
+
+        // Borrow the projection ImGui has already worked out for this frame
+        float projection[16]{};
+        glGetUniformfv(imgui_program, glGetUniformLocation(imgui_program, "ProjMtx"), projection);
+
+        glUseProgram(shader.program);
+        glUniformMatrix4fv(shader.projection, 1, GL_FALSE, projection);
+        glUniform1i(shader.indices, 0);
+        glUniform1i(shader.palette, 1);
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(reinterpret_cast<intptr_t>(command->UserCallbackData)));
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void free_palette_shader() noexcept
+    {
+        if (shared_palette_shader.program != 0)
+        {
+            glDeleteProgram(shared_palette_shader.program);
+            shared_palette_shader = {};
+        }
+    }
+
+    void draw_texture(GLtexture const& texture, ImVec2 const& size)
+    {
+        auto const cursor = ImGui::GetCursorScreenPos();
+        ImGui::Dummy(size);
+        draw_texture(ImGui::GetWindowDrawList(), texture, cursor, { cursor.x + size.x, cursor.y + size.y });
+    }
+
+    void draw_texture(ImDrawList* draw_list, GLtexture const& texture, ImVec2 const& p_min, ImVec2 const& p_max)
+    {
+        auto const texture_id = reinterpret_cast<ImTextureID>(static_cast<intptr_t>(texture.texture_id));
+        if (texture.palette_id == 0)
+        {
+            draw_list->AddImage(texture_id, p_min, p_max);
+            return;
+        }
+
+        begin_palette_draw(draw_list, texture.palette_id);
+        draw_list->AddImage(texture_id, p_min, p_max);
+        end_palette_draw(draw_list);
+    }
+
+    void begin_palette_draw(ImDrawList* draw_list, GLuint palette_id)
+    {
+        draw_list->AddCallback(&bind_palette_shader, reinterpret_cast<void*>(static_cast<intptr_t>(palette_id)));
+    }
+
+    void end_palette_draw(ImDrawList* draw_list)
+    {
+        draw_list->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
     }
-}
\ No newline at end of file
+}
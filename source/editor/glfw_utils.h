@@ -5,6 +5,9 @@
 #include <string_view>
 #include <exception>
 #include <memory>
+#include <span>
+#include "imgui.h"
+
 #include "simple_image.h"
 
 namespace NEONnoir
@@ -56,14 +59,38 @@ namespace NEONnoir
 
     using GLFWwindow_ptr = glfw_ptr<GLFWwindow>;
 
+    // Indexed images are uploaded as they are, one byte per pixel, along with a 256x1 palette
+    // texture. The palette is applied by a shader as the texture is drawn, so changing it is a
+    // 1 KB upload instead of expanding and uploading the whole image again.
     struct GLtexture
     {
         GLuint texture_id{};
+        GLuint palette_id{};        // 0 for truecolor textures
         int32_t width{};
         int32_t height{};
         operator void* () { return (void*)(intptr_t)texture_id; }
     };
 
+    // The editor only redraws when something happens. This wakes it up if it's waiting for
+    // events, e.g. when a background job is done. Safe to call from any thread.
+    void request_redraw() noexcept;
+    bool consume_redraw_request() noexcept;
+
     GLtexture load_texture(MPG::simple_image const& image);
+    void update_texture_palette(GLtexture const& texture, std::span<MPG::rgba_color const> palette);
     void free_texture(GLtexture& texture);
+
+    GLuint create_palette_texture(std::span<MPG::rgba_color const> palette);
+    void update_palette_texture(GLuint palette_id, std::span<MPG::rgba_color const> palette);
+
+    // Everything drawn between these two calls is treated as indices into the palette texture
+    void begin_palette_draw(ImDrawList* draw_list, GLuint palette_id);
+    void end_palette_draw(ImDrawList* draw_list);
+
+    // Releases the shader behind the palette draws, while the GL context is still around
+    void free_palette_shader() noexcept;
+
+    // Replacements for ImGui::Image and ImDrawList::AddImage that know how to draw indexed textures
+    void draw_texture(GLtexture const& texture, ImVec2 const& size);
+    void draw_texture(ImDrawList* draw_list, GLtexture const& texture, ImVec2 const& p_min, ImVec2 const& p_max);
 }
\ No newline at end of file
@@ -22,7 +22,7 @@ namespace NEONnoir
         }
 
         ImGui::SameLine(ImGui::GetWindowWidth() - 30);
-        HelpMarker("Converts between indexed BMPs and ILBMs.");
+        HelpMarker("Converts between indexed BMPs and ILBMs. Truecolor BMPs are quantized to the output bit-depth.");
 
         if (ImGui::Button(ICON_MD_FILE_OPEN " Load image...", button_size))
         {
@@ -43,17 +43,19 @@ namespace NEONnoir
                     break;
                 }
 
+                // Truecolor images get a palette of their own, made again for every bit depth picked
+                _truecolor_image = std::nullopt;
                 if (_source_image.bit_depth > 8)
-                    throw std::runtime_error("Only indexed images are supported.");
+                {
+                    _truecolor_image = std::move(_source_image);
+                    _source_image = MPG::reduce_bit_depth(_truecolor_image.value(), 8, static_cast<MPG::dither_mode>(_dither));
+                }
 
                 _export_bit_depth = _source_image.bit_depth;
 
                 // Convert the image to a usable texture
-                if (_source_texture)
-                {
-                    free_texture(_source_texture.value());
-                }
-                _source_texture = load_texture(_source_image);
+                show_source(_source_image);
+                _is_preview_dithered = false;
                 //_source_texture = load_texture(source_image_path.value());
             }
         }
@@ -68,20 +70,35 @@ namespace NEONnoir
 
             //ImGui::Combo("Output bit-depth", &_export_bit_depth, " 1-bit\0 2-bit\0 3-bit\0 4-bit\0 5-bit \0 6-bit\0 7-bit\0 8-bit\0\0");
             ImGui::SetNextItemWidth(button_size.x);
-            ImGui::SliderInt("##slider", &_export_bit_depth, 1, 8, "Output bit-depth: %d");
+            if (ImGui::SliderInt("##slider", &_export_bit_depth, 1, 8, "Output bit-depth: %d"))
+            {
+                preview_bit_depth();
+            }
+
+            ImGui::SetNextItemWidth(button_size.x);
+            if (ImGui::Combo("##dither", &_dither, "No dithering\0Ordered dither\0Floyd-Steinberg\0\0"))
+            {
+                preview_bit_depth();
+            }
+
             if (ImGui::Button("Export ILBM...", button_size))
             {
                 auto dest_image_path = save_file_dialog("iff");
                 if (dest_image_path)
                 {
-                    _dest_image = MPG::simple_image{ _source_image };
-                    if (_export_bit_depth > _source_image.bit_depth)
+                    if (_export_bit_depth < _source_image.bit_depth)
                     {
-                        _dest_image.color_palette.resize(static_cast<size_t>(1) << _export_bit_depth);
+                        _dest_image = MPG::reduce_bit_depth(_source_image, to<uint8_t>(_export_bit_depth), static_cast<MPG::dither_mode>(_dither));
                     }
-                    else if (_export_bit_depth < _source_image.bit_depth)
+                    else
                     {
-                        _dest_image = MPG::crop_palette(_dest_image, to<uint8_t>(_export_bit_depth), 0);
+                        _dest_image = MPG::simple_image{ _source_image };
+                        if (_export_bit_depth > _source_image.bit_depth)
+                        {
+                            auto colors = _dest_image.color_palette.to_vector();
+                            colors.resize(static_cast<size_t>(1) << _export_bit_depth);
+                            _dest_image.color_palette = colors;
+                        }
                     }
 
                     _dest_image.bit_depth = _export_bit_depth;
@@ -94,12 +111,63 @@ namespace NEONnoir
         return true;
     }
 
+    void image_converter::preview_bit_depth()
+    {
+        if (!_source_texture)
+            return;
+
+        auto const bit_depth = to<uint8_t>(_export_bit_depth);
+        auto const dither = static_cast<MPG::dither_mode>(_dither);
+
+        if (_truecolor_image)
+        {
+            _source_image = MPG::reduce_bit_depth(_truecolor_image.value(), bit_depth, dither);
+            show_source(_source_image);
+            return;
+        }
+
+        // Dithering moves pixels around, the preview needs an image of its own
+        if (dither != MPG::dither_mode::none && MPG::loses_colors(_source_image, bit_depth))
+        {
+            show_source(MPG::reduce_bit_depth(_source_image, bit_depth, dither));
+            _is_preview_dithered = true;
+            return;
+        }
+
+        if (_is_preview_dithered)
+        {
+            show_source(_source_image);
+            _is_preview_dithered = false;
+        }
+
+        // Show what clamping the palette will do: anything past the new range becomes the overflow color.
+        // Only the palette texture changes, the image itself stays on the GPU as it is.
+        auto palette = _source_image.color_palette.to_vector();
+        auto const color_count = static_cast<size_t>(1) << _export_bit_depth;
+        for (auto index = color_count; index < palette.size(); index++)
+        {
+            palette[index] = palette[0];
+        }
+
+        update_texture_palette(_source_texture.value(), palette);
+    }
+
+    void image_converter::show_source(MPG::simple_image const& image)
+    {
+        if (_source_texture)
+        {
+            free_texture(_source_texture.value());
+        }
+
+        _source_texture = load_texture(image);
+    }
+
     void image_converter::display_image(std::optional<GLtexture>& texture)
     {
         if (!texture)
             return;
 
         auto& value = texture.value();
-        ImGui::Image(value, ImVec2((float)(value.width), (float)(value.height)));
+        draw_texture(value, ImVec2((float)(value.width), (float)(value.height)));
     }
 }
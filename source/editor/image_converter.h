@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include "image_dither.h"
 #include "simple_image.h"
 #include "glfw_utils.h"
 #include "image_viewer.h"
@@ -14,15 +15,20 @@ namespace NEONnoir
 
     private:
         void display_image(std::optional<GLtexture>& image);
+        void preview_bit_depth();
+        void show_source(MPG::simple_image const& image);
 
     private:
         image_viewer _image_viewer;
         MPG::simple_image _source_image;
         MPG::simple_image _dest_image;
+        std::optional<MPG::simple_image> _truecolor_image{ std::nullopt };
 
         std::optional<GLtexture> _source_texture{ std::nullopt };
         std::optional<GLtexture> _dest_texture{ std::nullopt };
 
         int32_t _export_bit_depth{ 0 };
+        int32_t _dither{ 0 };                   // An MPG::dither_mode
+        bool _is_preview_dithered{ false };
     };
 }
\ No newline at end of file
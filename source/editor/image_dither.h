@@ -0,0 +1,323 @@
+#pragma once
+
+#include "simple_image.h"
+#include "color_quantizer.h"
+#include "palette_matcher.h"
+
+namespace MPG
+{
+    // Brings images down to a smaller palette without banding gradients the way clamping does.
+    // Colors are looked up with a palette_matcher made once per palette and shared by every thread.
+    //
+    // Ordered dithering adds an 8x8 Bayer pattern to every pixel, rows are independent so they're
+    // dithered side by side, 16 pixels at a time. Error diffusion (Floyd-Steinberg) hands each
+    // pixel's error on to its neighbours below, so a row can only get as far as the row above it:
+    // rows run side by side as a wavefront, each one trailing the one above.
+    enum class dither_mode
+    {
+        none,                   // Plain nearest color
+        ordered,
+        error_diffusion,
+    };
+
+    // Maps every pixel of an indexed or truecolor image to the nearest color of the palette and
+    // returns the result as a new image of the given bit depth with that palette. Alpha is ignored.
+    simple_image dither_image(image_view const& source, std::span<rgba_color const> palette, uint8_t bit_depth, dither_mode mode);
+
+    // Whether bringing the image down to the bit depth drops any colors: truecolor images always
+    // do, indexed ones only if their palette is longer than 2^bit_depth
+    bool loses_colors(image_view const& source, uint8_t bit_depth) noexcept;
+
+    // Brings an image down to the bit depth. Truecolor images are quantized, indexed ones keep the
+    // first 2^bit_depth colors of their palette, like crop_palette. Either way the colors that are
+    // lost are dithered with the ones that are left, unless the mode is none.
+    simple_image reduce_bit_depth(image_view const& source, uint8_t bit_depth, dither_mode mode);
+}
+
+//#define IMAGE_DITHER_IMPL
+#ifdef IMAGE_DITHER_IMPL
+
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(__AVX2__)
+#include <emmintrin.h>
+#define MPG_DITHER_SSE2
+#endif
+
+namespace MPG
+{
+    constexpr std::array<uint8_t, 64> bayer_matrix
+    {
+         0, 32,  8, 40,  2, 34, 10, 42,
+        48, 16, 56, 24, 50, 18, 58, 26,
+        12, 44,  4, 36, 14, 46,  6, 38,
+        60, 28, 52, 20, 62, 30, 54, 22,
+         3, 35, 11, 43,  1, 33,  9, 41,
+        51, 19, 59, 27, 49, 17, 57, 25,
+        15, 47,  7, 39, 13, 45,  5, 37,
+        63, 31, 55, 23, 61, 29, 53, 21,
+    };
+
+    // Splits a row into one array per channel. Indexed pixels go through their palette.
+    template<typename Format>
+    void expand_row(typed_view<Format> const& pixels, uint32_t y, std::array<rgba_color, 256> const& source_colors, uint8_t* r, uint8_t* g, uint8_t* b) noexcept
+    {
+        auto pixel = pixels.row(y);
+        for (auto x = 0u; x < pixels.width; x++, pixel += Format::bytes_per_pixel)
+        {
+            if constexpr (Format::bytes_per_pixel == 1)
+            {
+                auto const& color = source_colors[pixel[0]];
+                r[x] = color.r;
+                g[x] = color.g;
+                b[x] = color.b;
+            }
+            else
+            {
+                r[x] = pixel[0];
+                g[x] = pixel[1];
+                b[x] = pixel[2];
+            }
+        }
+    }
+
+    // Nudges every pixel by its place in the Bayer pattern before looking it up. The same nudge
+    // goes to all three channels, in either direction, saturating at black and white. The nudges
+    // add up to spread from one end of the pattern to the other.
+    template<typename Format>
+    void dither_ordered(typed_view<Format> const& pixels, std::array<rgba_color, 256> const& source_colors, palette_matcher const& matcher, float spread, simple_image& result)
+    {
+        run_in_bands(pixels.height, 16, [&](size_t first_row, size_t last_row)
+            {
+                auto channels = std::vector<uint8_t>(static_cast<size_t>(pixels.width) * 3);
+                auto const r = channels.data();
+                auto const g = r + pixels.width;
+                auto const b = g + pixels.width;
+
+                for (auto y = first_row; y < last_row; y++)
+                {
+                    expand_row(pixels, static_cast<uint32_t>(y), source_colors, r, g, b);
+
+                    // Two periods of this row of the pattern, as how much to add and how much to take away
+                    auto plus = std::array<uint8_t, 16>{};
+                    auto minus = std::array<uint8_t, 16>{};
+                    for (auto x = 0u; x < 16; x++)
+                    {
+                        auto const threshold = bayer_matrix[(y & 7) * 8 + (x & 7)];
+                        auto const offset = static_cast<int32_t>(std::lround((threshold - 31.5f) * spread / 64.f));
+                        plus[x] = static_cast<uint8_t>(std::max(offset, 0));
+                        minus[x] = static_cast<uint8_t>(std::max(-offset, 0));
+                    }
+
+                    auto destination = result.pixel_data.data() + y * pixels.width;
+                    auto x = 0u;
+
+#ifdef MPG_DITHER_SSE2
+                    auto const add = _mm_loadu_si128(reinterpret_cast<__m128i const*>(plus.data()));
+                    auto const subtract = _mm_loadu_si128(reinterpret_cast<__m128i const*>(minus.data()));
+
+                    // The nudged channels, 16 pixels at a time
+                    auto nudged = std::array<uint8_t, 48>{};
+                    for (; x + 16 <= pixels.width; x += 16)
+                    {
+                        auto const nudge = [&](uint8_t const* channel, size_t offset)
+                            {
+                                auto const value = _mm_loadu_si128(reinterpret_cast<__m128i const*>(channel + x));
+                                _mm_storeu_si128(reinterpret_cast<__m128i*>(nudged.data() + offset), _mm_subs_epu8(_mm_adds_epu8(value, add), subtract));
+                            };
+
+                        nudge(r, 0);
+                        nudge(g, 16);
+                        nudge(b, 32);
+
+                        for (auto i = 0u; i < 16; i++)
+                        {
+                            destination[x + i] = matcher.find(nudged[i], nudged[16 + i], nudged[32 + i]);
+                        }
+                    }
+#endif
+
+                    for (; x < pixels.width; x++)
+                    {
+                        auto const nudge = [&](uint8_t value)
+                            {
+                                return static_cast<uint8_t>(std::clamp(value + plus[x & 15] - minus[x & 15], 0, 255));
+                            };
+
+                        destination[x] = matcher.find(nudge(r[x]), nudge(g[x]), nudge(b[x]));
+                    }
+                }
+            });
+    }
+
+    // Floyd-Steinberg. Errors are kept in sixteenths, which is what the weights are in. Row y reads
+    // the errors left for it from one buffer and leaves its own for row y + 1 in the next, so with a
+    // ring of one buffer more than there are threads, no buffer is reused before both its rows are
+    // done with it.
+    template<typename Format>
+    void dither_error_diffusion(typed_view<Format> const& pixels, std::array<rgba_color, 256> const& source_colors, palette_matcher const& matcher, simple_image& result)
+    {
+        // How far a row may get before it tells the one below
+        constexpr auto chunk_size = 32u;
+
+        auto const width = pixels.width;
+        auto const palette = matcher.palette();
+        auto const cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        auto const thread_count = std::clamp<size_t>(std::min<size_t>(pixels.height / 8, width / (chunk_size * 4)), 1, cores);
+        auto const ring_size = thread_count + 1;
+
+        // Per buffer: three channels, with a pixel to spare on either side
+        auto const errors_size = (static_cast<size_t>(width) + 2) * 3;
+        auto errors = std::vector<int32_t>(errors_size * ring_size);
+        auto progress = std::vector<std::atomic<uint32_t>>(pixels.height);
+
+        auto const dither_rows = [&](size_t first_row)
+            {
+                auto channels = std::vector<uint8_t>(static_cast<size_t>(width) * 3);
+                auto const r = channels.data();
+                auto const g = r + width;
+                auto const b = g + width;
+
+                for (auto y = first_row; y < pixels.height; y += thread_count)
+                {
+                    expand_row(pixels, static_cast<uint32_t>(y), source_colors, r, g, b);
+
+                    auto const incoming = errors.data() + (y % ring_size) * errors_size + 3;
+                    auto const outgoing = errors.data() + ((y + 1) % ring_size) * errors_size + 3;
+                    std::fill(outgoing - 3, outgoing - 3 + errors_size, 0);
+
+                    auto destination = result.pixel_data.data() + y * width;
+                    auto carry = std::array<int32_t, 3>{};
+
+                    for (auto x = 0u; x < width; x++)
+                    {
+                        if (x % chunk_size == 0)
+                        {
+                            // Everything the row above hands down up to the end of this chunk has to be there
+                            if (y > 0)
+                            {
+                                auto const needed = std::min(x + chunk_size + 1, width);
+                                while (progress[y - 1].load(std::memory_order_acquire) < needed)
+                                {
+                                    std::this_thread::yield();
+                                }
+                            }
+
+                            progress[y].store(x, std::memory_order_release);
+                        }
+
+                        auto const source = std::array<uint8_t, 3>{ r[x], g[x], b[x] };
+                        auto desired = std::array<int32_t, 3>{};
+                        for (auto channel = 0; channel < 3; channel++)
+                        {
+                            desired[channel] = std::clamp(source[channel] + ((incoming[x * 3 + channel] + carry[channel] + 8) >> 4), 0, 255);
+                        }
+
+                        auto const index = matcher.find(
+                            static_cast<uint8_t>(desired[0]),
+                            static_cast<uint8_t>(desired[1]),
+                            static_cast<uint8_t>(desired[2]));
+                        destination[x] = index;
+
+                        auto const& chosen = palette[index];
+                        auto const error = std::array<int32_t, 3>{ desired[0] - chosen.r, desired[1] - chosen.g, desired[2] - chosen.b };
+
+                        for (auto channel = 0; channel < 3; channel++)
+                        {
+                            carry[channel] = error[channel] * 7;
+                            outgoing[(static_cast<ptrdiff_t>(x) - 1) * 3 + channel] += error[channel] * 3;
+                            outgoing[x * 3 + channel] += error[channel] * 5;
+                            outgoing[(x + 1) * 3 + channel] += error[channel];
+                        }
+                    }
+
+                    progress[y].store(width, std::memory_order_release);
+                }
+            };
+
+        auto workers = std::vector<std::jthread>{};
+        for (auto thread = size_t{ 1 }; thread < thread_count; thread++)
+        {
+            workers.emplace_back(dither_rows, thread);
+        }
+
+        dither_rows(0);
+    }
+
+    simple_image dither_image(image_view const& source, std::span<rgba_color const> palette, uint8_t bit_depth, dither_mode mode)
+    {
+        if (bit_depth < 1 || bit_depth > 8)
+            throw std::runtime_error("Bit-depth must be between 1 and 8");
+
+        if (palette.empty() || palette.size() > (size_t{ 1 } << bit_depth))
+            throw std::runtime_error("The palette doesn't fit the bit-depth.");
+
+        auto result = simple_image{ source.width, source.height, bit_depth };
+        result.color_palette = color_palette(palette.begin(), palette.end());
+        result.pixel_data.resize(static_cast<size_t>(source.width) * source.height);
+
+        // Indices past the end of the source's palette come out black
+        auto source_colors = std::array<rgba_color, 256>{};
+        if (source.palette)
+        {
+            std::copy_n(source.palette->begin(), std::min(source.palette->size(), source_colors.size()), source_colors.begin());
+        }
+
+        auto const matcher = palette_matcher{ palette };
+
+        visit_pixels(source, [&](auto const& pixels)
+            {
+                switch (mode)
+                {
+                case dither_mode::ordered:
+                    // About the distance between neighbouring palette colors, if they were spread evenly
+                    dither_ordered(pixels, source_colors, matcher, 255.f / std::cbrt(static_cast<float>(std::max<size_t>(palette.size(), 2))), result);
+                    break;
+
+                case dither_mode::error_diffusion:
+                    dither_error_diffusion(pixels, source_colors, matcher, result);
+                    break;
+
+                default:
+                    // No pattern is the same as a pattern of nothing
+                    dither_ordered(pixels, source_colors, matcher, 0.f, result);
+                    break;
+                }
+            });
+
+        return result;
+    }
+
+    bool loses_colors(image_view const& source, uint8_t bit_depth) noexcept
+    {
+        return source.bytes_per_pixel > 1 || (source.palette && source.palette->size() > (size_t{ 1 } << bit_depth));
+    }
+
+    simple_image reduce_bit_depth(image_view const& source, uint8_t bit_depth, dither_mode mode)
+    {
+        if (source.bytes_per_pixel > 1)
+        {
+            if (mode == dither_mode::none)
+                return quantize_image(source, bit_depth);
+
+            // Dither against the colors that are actually used, then pad the palette like quantize_image does
+            auto colors = make_quantized_palette(source, bit_depth);
+            auto result = dither_image(source, colors, bit_depth, mode);
+
+            colors.resize(size_t{ 1 } << bit_depth);
+            result.color_palette = colors;
+
+            return result;
+        }
+
+        if (mode == dither_mode::none || !loses_colors(source, bit_depth))
+            return crop_palette(source, bit_depth, 0);
+
+        return dither_image(source, crop_palette_colors(source.palette, bit_depth), bit_depth, mode);
+    }
+}
+
+#endif // IMAGE_DITHER_IMPL
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include <chrono>
+
+#include "glfw_utils.h"
+#include "image_loader.h"
+
+namespace NEONnoir
+{
+    image_loader::image_loader()
+        : _worker{ [this](std::stop_token stop) { run(stop); } }
+    {
+    }
+
+    image_loader::~image_loader() noexcept
+    {
+        _worker.request_stop();
+        _request_count.release();
+    }
+
+    uint64_t image_loader::load(std::filesystem::path const& file)
+    {
+        auto const ticket = _next_ticket++;
+
+        // If the worker is that far behind, there's not much else to do than wait for it
+        auto pending = request{ ticket, file };
+        while (!_requests.try_push(std::move(pending)))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+        }
+
+        _pending++;
+        _request_count.release();
+
+        return ticket;
+    }
+
+    std::optional<image_loader::result> image_loader::poll()
+    {
+        auto finished = _results.try_pop();
+        if (finished)
+        {
+            _pending--;
+        }
+
+        return finished;
+    }
+
+    void image_loader::run(std::stop_token stop)
+    {
+        while (true)
+        {
+            _request_count.acquire();
+            if (stop.stop_requested())
+                return;
+
+            auto next = _requests.try_pop();
+            if (!next)
+                continue;
+
+            auto finished = result{ next->ticket, next->file };
+            try
+            {
+                finished.image = MPG::load_image(next->file);
+            }
+            catch (...)
+            {
+                // Rethrown on the UI thread
+                finished.error = std::current_exception();
+            }
+
+            while (!_results.try_push(std::move(finished)))
+            {
+                if (stop.stop_requested())
+                    return;
+
+                std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+            }
+
+            request_redraw();
+        }
+    }
+}
\ No newline at end of file
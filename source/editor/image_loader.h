@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <optional>
+#include <semaphore>
+#include <thread>
+
+#include "simple_image.h"
+#include "spsc_queue.h"
+
+namespace NEONnoir
+{
+    // Decodes images on a worker thread so that the UI doesn't freeze while a large file loads.
+    // Requests go in and decoded images come back out through lock-free queues, in the order they
+    // were requested. Both load() and poll() must be called from the same (UI) thread.
+    class image_loader
+    {
+    public:
+        struct result
+        {
+            uint64_t ticket{};
+            std::filesystem::path file{};
+            MPG::simple_image image{};
+            std::exception_ptr error{};     // Set if the image couldn't be loaded
+        };
+
+        image_loader();
+        ~image_loader() noexcept;
+
+        image_loader(image_loader const&) = delete;
+        image_loader& operator=(image_loader const&) = delete;
+
+        // Queues an image to be decoded and returns a ticket that identifies its result
+        uint64_t load(std::filesystem::path const& file);
+
+        // Non-blocking. Returns the next decoded image, if one is ready.
+        std::optional<result> poll();
+
+        bool is_busy() const noexcept { return _pending > 0; }
+
+    private:
+        struct request
+        {
+            uint64_t ticket{};
+            std::filesystem::path file{};
+        };
+
+        void run(std::stop_token stop);
+
+    private:
+        static constexpr size_t queue_size = 64;
+
+        spsc_queue<request, queue_size> _requests{};
+        spsc_queue<result, queue_size> _results{};
+        std::counting_semaphore<> _request_count{ 0 };
+
+        uint64_t _next_ticket{ 0 };
+        std::atomic<size_t> _pending{ 0 };
+
+        std::jthread _worker{};
+    };
+}
\ No newline at end of file
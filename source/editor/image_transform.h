@@ -0,0 +1,172 @@
+#pragma once
+
+#include "simple_image.h"
+
+namespace MPG
+{
+    // Geometric transforms that work on the image's own pixels, for indexed and truecolor images
+    // alike. Flipping and mirroring don't allocate at all. Rotating by a quarter turn swaps the
+    // width and height, so it goes through one scratch buffer of the same size as the image.
+
+    enum class rotation
+    {
+        clockwise,              // 90 degrees
+        half_turn,              // 180 degrees
+        counterclockwise,       // 270 degrees
+    };
+
+    // Swaps rows top to bottom
+    void flip_vertical_in_place(simple_image& image);
+
+    // Reverses the pixels of every row
+    void mirror_horizontal_in_place(simple_image& image);
+
+    void rotate_in_place(simple_image& image, rotation direction);
+}
+
+//#define IMAGE_TRANSFORM_IMPL
+#ifdef IMAGE_TRANSFORM_IMPL
+
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(_M_X64)
+#include <immintrin.h>
+#define MPG_TRANSFORM_SSSE3
+#endif
+
+namespace MPG
+{
+    void flip_vertical_in_place(simple_image& image)
+    {
+        auto const row_size = static_cast<size_t>(image.width) * get_bytes_per_pixel(image.bit_depth);
+        if (image.height < 2 || row_size == 0)
+            return;
+
+        auto top = image.pixel_data.data();
+        auto bottom = top + (image.height - 1) * row_size;
+
+        for (; top < bottom; top += row_size, bottom -= row_size)
+        {
+            std::swap_ranges(top, top + row_size, bottom);
+        }
+    }
+
+    // Reverses the order of the pixels in a row of a known pixel size
+    template<typename Format>
+    void reverse_row(uint8_t* row, uint32_t width) noexcept
+    {
+        constexpr auto bytes_per_pixel = Format::bytes_per_pixel;
+
+        auto left = row;
+        auto right = row + static_cast<size_t>(width) * bytes_per_pixel;
+
+#ifdef MPG_TRANSFORM_SSSE3
+        if constexpr (bytes_per_pixel == 1 || bytes_per_pixel == 4)
+        {
+            if (has_ssse3())
+            {
+                // Swap 16 bytes off each end at a time, reversing them on the way
+                auto const reverse = bytes_per_pixel == 1
+                    ? _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+                    : _mm_setr_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+                while (right - left >= 32)
+                {
+                    right -= 16;
+
+                    auto const head = _mm_loadu_si128(reinterpret_cast<__m128i const*>(left));
+                    auto const tail = _mm_loadu_si128(reinterpret_cast<__m128i const*>(right));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(left), _mm_shuffle_epi8(tail, reverse));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(right), _mm_shuffle_epi8(head, reverse));
+
+                    left += 16;
+                }
+            }
+        }
+#endif
+
+        // Whatever is left in the middle, a pixel at a time
+        while (right - left >= static_cast<ptrdiff_t>(2 * bytes_per_pixel))
+        {
+            right -= bytes_per_pixel;
+            std::swap_ranges(left, left + bytes_per_pixel, right);
+            left += bytes_per_pixel;
+        }
+    }
+
+    // The view only says what the pixels are, they're written through the image's own buffer
+    template<typename Format>
+    void mirror_rows(typed_view<Format> const& pixels, uint8_t* destination) noexcept
+    {
+        for (auto y = 0u; y < pixels.height; y++)
+        {
+            reverse_row<Format>(destination + y * pixels.stride, pixels.width);
+        }
+    }
+
+    void mirror_horizontal_in_place(simple_image& image)
+    {
+        visit_pixels(image, [&](auto const& pixels) { mirror_rows(pixels, image.pixel_data.data()); });
+    }
+
+    // Moves every pixel to its place in the rotated image, a block at a time so that both the rows
+    // being read and the ones being written stay in the cache
+    template<typename Format>
+    void transpose_rotate(typed_view<Format> const& source, bool clockwise, uint8_t* destination) noexcept
+    {
+        constexpr auto bytes_per_pixel = Format::bytes_per_pixel;
+        constexpr auto block_size = 32u;
+
+        auto const width = source.width;
+        auto const height = source.height;
+
+        // The rotated image is height pixels wide
+        auto const destination_stride = static_cast<size_t>(height) * bytes_per_pixel;
+
+        for (auto block_y = 0u; block_y < height; block_y += block_size)
+        {
+            auto const end_y = std::min(block_y + block_size, height);
+
+            for (auto block_x = 0u; block_x < width; block_x += block_size)
+            {
+                auto const end_x = std::min(block_x + block_size, width);
+
+                for (auto y = block_y; y < end_y; y++)
+                {
+                    auto const source_row = source.row(y);
+
+                    for (auto x = block_x; x < end_x; x++)
+                    {
+                        auto const destination_x = clockwise ? height - 1 - y : y;
+                        auto const destination_y = clockwise ? x : width - 1 - x;
+
+                        std::memcpy(
+                            destination + destination_y * destination_stride + static_cast<size_t>(destination_x) * bytes_per_pixel,
+                            source_row + static_cast<size_t>(x) * bytes_per_pixel,
+                            bytes_per_pixel);
+                    }
+                }
+            }
+        }
+    }
+
+    void rotate_in_place(simple_image& image, rotation direction)
+    {
+        if (direction == rotation::half_turn)
+        {
+            flip_vertical_in_place(image);
+            mirror_horizontal_in_place(image);
+            return;
+        }
+
+        auto const clockwise = direction == rotation::clockwise;
+        auto rotated = pixel_data(image.pixel_data.size());
+
+        visit_pixels(image, [&](auto const& pixels) { transpose_rotate(pixels, clockwise, rotated.data()); });
+
+        image.pixel_data.swap(rotated);
+        std::swap(image.width, image.height);
+    }
+}
+
+#endif // IMAGE_TRANSFORM_IMPL
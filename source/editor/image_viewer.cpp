@@ -2,6 +2,10 @@
 #include "IconsMaterialDesign.h"
 
 #include "imgui_utils.h"
+#include "sprite_slicer.h"
+#include "utils.h"
+
+#include <cmath>
 
 void NEONnoir::image_viewer::display(GLtexture const& texture) noexcept
 {
@@ -10,35 +14,41 @@ void NEONnoir::image_viewer::display(GLtexture const& texture) noexcept
 
     if (ImGui::SmallButton(ICON_MD_ZOOM_IN))
     {
-        _zoom++;
+        zoom_in();
     }
     ToolTip("Zoom In");
 
     ImGui::SameLine();
 
-    if (ImGui::SmallButton(ICON_MD_ZOOM_OUT) && _zoom > 1)
+    if (ImGui::SmallButton(ICON_MD_ZOOM_OUT))
     {
-        _zoom--;
+        zoom_out();
     }
     ToolTip("Zoom Out");
 
     ImGui::PopStyleColor();
 
     // Stats
-    ImGui::Text(ICON_MD_NEAR_ME " %.0f, %.0f\t" ICON_MD_ZOOM_IN " %d00%%", _last_mouse.x, _last_mouse.y, _zoom);
-    ImGui::Image((void*)(intptr_t)texture.texture_id, ImVec2((float)(texture.width * _zoom), (float)(texture.height * _zoom)));
+    auto const scale = get_scale();
+    ImGui::Text(ICON_MD_NEAR_ME " %.0f, %.0f\t" ICON_MD_ZOOM_IN " %.0f%%", _last_mouse.x, _last_mouse.y, scale * 100.f);
+    draw_texture(texture, ImVec2(texture.width * scale, texture.height * scale));
 
     // Image
     ImGuiIO& io = ImGui::GetIO(); (void)io;
     auto image_min = ImGui::GetItemRectMin();
     if (ImGui::IsItemHovered())
     {
-        _last_mouse = (io.MousePos - image_min) / _zoom;
+        _last_mouse = to_image_space(io.MousePos, image_min);
     }
 }
 
-void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape>& regions) noexcept
+bool NEONnoir::image_viewer::display(shape_container& container) noexcept
 {
+    auto& texture = container.texture;
+    auto const& image = container.image;
+    auto& regions = container.shapes;
+    auto const region_count = regions.size();
+
     // Toolbar
     ImGui::PushStyleColor(ImGuiCol_Button, ImGui::GetStyleColorVec4(ImGuiCol_WindowBg));
 
@@ -52,8 +62,9 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
     if (ImGui::Button(ICON_MD_CROP_SQUARE))
     {
         regions.push_back(shape{
-            0, 0, static_cast<uint16_t>(texture.width), static_cast<uint16_t>(texture.height)
+            0, 0, static_cast<uint16_t>(image.width), static_cast<uint16_t>(image.height)
             });
+        container.index.insert(regions.back());
     }
     ToolTip("Select whole image");
     ImGui::SameLine();
@@ -91,6 +102,17 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
                 ImGui::TableNextColumn();
                 ImGui::SetNextItemWidth(100);
                 ImGui::InputInt("##_cell_height", &_cell_height);
+
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::AlignTextToFramePadding();
+                ImGui::TextUnformatted("Skip empty cells");
+
+                ImGui::TableNextColumn();
+                ImGui::BeginDisabled(image.bit_depth > 8);
+                ImGui::Checkbox("##_skip_empty_cells", &_skip_empty_cells);
+                ImGui::EndDisabled();
+                ToolTip("Don't add regions for cells that are all transparent");
             }
 
             ImGui::NewLine();
@@ -105,10 +127,20 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
 
             if (ImGui::Button("Autogrid"))
             {
-                for (auto y = 0; y < texture.height / _cell_height; y++)
+                // Every cell is checked in four lookups, however big the cells are
+                auto const skip_empty = _skip_empty_cells && image.bit_depth <= 8;
+                if (skip_empty)
+                {
+                    container.coverage.update(image, container.image_generation, 0);
+                }
+
+                for (auto y = 0; y < to<int32_t>(image.height) / _cell_height; y++)
                 {
-                    for (auto x = 0; x < texture.width / _cell_width; x++)
+                    for (auto x = 0; x < to<int32_t>(image.width) / _cell_width; x++)
                     {
+                        if (skip_empty && container.coverage.count(to<uint32_t>(x * _cell_width), to<uint32_t>(y * _cell_height), to<uint32_t>(_cell_width), to<uint32_t>(_cell_height)) == 0)
+                            continue;
+
                         regions.push_back(shape
                         { 
                             static_cast<uint16_t>(x * _cell_width), 
@@ -116,6 +148,7 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
                             static_cast<uint16_t>(_cell_width), 
                             static_cast<uint16_t>(_cell_height)
                         });
+                        container.index.insert(regions.back());
                     }
                 }
                 _show_autogrid_popup = false;
@@ -128,44 +161,148 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
 
     ImGui::SameLine();
 
+    if (ImGui::Button(ICON_MD_CONTENT_CUT))
+    {
+        _show_autoslice_popup = true;
+
+        // The top left corner is as good a guess for the background as any
+        _slice_background = image.bit_depth <= 8 && !image.pixel_data.empty() ? image.pixel_data[0] : 0;
+    }
+    ToolTip("Auto-slice");
+
+    if (_show_autoslice_popup)
+    {
+        ImGui::OpenPopup("Autoslice");
+
+        ImVec2 center = ImGui::GetMainViewport()->GetCenter();
+        ImGui::SetNextWindowPos(center, ImGuiCond_Appearing, ImVec2(0.5f, 0.5f));
+        if (ImGui::BeginPopupModal("Autoslice", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+        {
+            auto const can_slice = image.bit_depth <= 8;
+            if (!can_slice)
+            {
+                ImGui::TextUnformatted("Only indexed images can be sliced");
+            }
+
+            if (auto table = imgui::table("properties", 2, ImGuiTableFlags_SizingStretchProp))
+            {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::AlignTextToFramePadding();
+                ImGui::TextUnformatted("Background");
+
+                ImGui::TableNextColumn();
+                ImGui::SetNextItemWidth(100);
+                ImGui::InputInt("##_slice_background", &_slice_background);
+                ToolTip("Palette index of the empty space between sprites");
+                _slice_background = std::clamp(_slice_background, 0, 255);
+
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::AlignTextToFramePadding();
+                ImGui::TextUnformatted("Gap");
+
+                ImGui::TableNextColumn();
+                ImGui::SetNextItemWidth(100);
+                ImGui::InputInt("##_slice_gap", &_slice_gap);
+                ToolTip("Sprites this many pixels apart or closer are sliced as one");
+                _slice_gap = std::clamp(_slice_gap, 0, 64);
+            }
+
+            ImGui::NewLine();
+
+            if (ImGui::Button("Cancel"))
+            {
+                _show_autoslice_popup = false;
+                ImGui::CloseCurrentPopup();
+            }
+
+            ImGui::SameLine();
+
+            ImGui::BeginDisabled(!can_slice);
+            if (ImGui::Button("Autoslice"))
+            {
+                auto const sprites = MPG::find_sprites(image, static_cast<uint8_t>(_slice_background), static_cast<uint32_t>(_slice_gap));
+                auto overlapping = std::vector<size_t>{};
+
+                for (auto const& sprite : sprites)
+                {
+                    auto const region = shape
+                    {
+                        static_cast<uint16_t>(sprite.x),
+                        static_cast<uint16_t>(sprite.y),
+                        static_cast<uint16_t>(sprite.width),
+                        static_cast<uint16_t>(sprite.height)
+                    };
+
+                    // Slicing again doesn't pile up copies of the regions that are already there.
+                    // A copy would have to overlap it, so only those need checking.
+                    container.index.query(regions, region.x, region.y, region.x + std::max<float>(region.width, 1.f), region.y + std::max<float>(region.height, 1.f), overlapping);
+                    if (std::ranges::none_of(overlapping, [&](size_t id) { return regions[id] == region; }))
+                    {
+                        regions.push_back(region);
+                        container.index.insert(regions.back());
+                    }
+                }
+
+                _show_autoslice_popup = false;
+                ImGui::CloseCurrentPopup();
+            }
+            ImGui::EndDisabled();
+
+            ImGui::EndPopup();
+        }
+    }
+
+    ImGui::SameLine();
+
     if (ImGui::SmallButton(ICON_MD_ZOOM_IN))
     {
-        _zoom++;
+        zoom_in();
     }
     ToolTip("Zoom In");
 
     ImGui::SameLine();
 
-    if (ImGui::SmallButton(ICON_MD_ZOOM_OUT) && _zoom > 1)
+    if (ImGui::SmallButton(ICON_MD_ZOOM_OUT))
     {
-        _zoom--;
+        zoom_out();
     }
     ToolTip("Zoom Out");
 
     ImGui::PopStyleColor();
 
     // Stats
-    ImGui::Text(ICON_MD_NEAR_ME " %.0f, %.0f\t" ICON_MD_ZOOM_IN " %d00%%", _last_mouse.x, _last_mouse.y, _zoom);
-    ImGui::Image((void*)(intptr_t)texture.texture_id, ImVec2((float)(texture.width * _zoom), (float)(texture.height * _zoom)));
+    auto const scale = get_scale();
+    ImGui::Text(ICON_MD_NEAR_ME " %.0f, %.0f\t" ICON_MD_ZOOM_IN " %.0f%%", _last_mouse.x, _last_mouse.y, scale * 100.f);
+    // Reserve the room for the whole image, but only draw the tiles that can be seen
+    ImGui::Dummy(ImVec2(image.width * scale, image.height * scale));
 
     // Image
     ImGuiIO& io = ImGui::GetIO(); (void)io;
     auto image_min = ImGui::GetItemRectMin();
     if (ImGui::IsItemHovered())
     {
-        _last_mouse = (io.MousePos - image_min) / _zoom;
+        _last_mouse = to_image_space(io.MousePos, image_min);
     }
 
-    // Regions
     auto draw_list = ImGui::GetWindowDrawList();
-    for (auto index = 0; index < regions.size(); index++)
+    texture.draw(draw_list, image, image_min, scale, _zoom_out);
+
+    // Regions, only the ones that intersect the visible part of the image
+    auto const visible_min = (draw_list->GetClipRectMin() - image_min) / scale;
+    auto const visible_max = (draw_list->GetClipRectMax() - image_min) / scale;
+
+    container.index.query(regions, visible_min.x, visible_min.y, visible_max.x, visible_max.y, _visible_regions);
+
+    for (auto const index : _visible_regions)
     {
         auto const& region = regions[index];
 
-        auto p0 = ImVec2{ static_cast<float>(region.x), static_cast<float>(region.y) } *_zoom + image_min;
-        auto p1 = ImVec2{ static_cast<float>(region.x + region.width), static_cast<float>(region.y + region.height) } *_zoom + image_min;
+        auto p0 = ImVec2{ static_cast<float>(region.x), static_cast<float>(region.y) } * scale + image_min;
+        auto p1 = ImVec2{ static_cast<float>(region.x + region.width), static_cast<float>(region.y + region.height) } * scale + image_min;
 
-        if (_selected_region_index == index)
+        if (_selected_region_index == static_cast<int32_t>(index))
         {
             draw_list->AddRectFilled(p0, p1, IM_COL32(255, 165, 0, 64));
             draw_list->AddRect(p0, p1, IM_COL32(255, 165, 0, 255), 0.f, 0, 2.f);
@@ -190,8 +327,8 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
         }
         if (io.MouseReleased[0] && _add_region_dragging)
         {
-            auto p0 = (_add_region_p0 - image_min) / _zoom;
-            auto p1 = (io.MousePos - image_min) / _zoom;
+            auto p0 = to_image_space(_add_region_p0, image_min);
+            auto p1 = to_image_space(io.MousePos, image_min);
 
             auto p_min = ImVec2
             {
@@ -212,6 +349,7 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
             };
 
             regions.push_back(region);
+            container.index.insert(region);
             _add_region_mode = false;
             _add_region_dragging = false;
             _add_region_p0 = { -1, -1 };
@@ -224,23 +362,40 @@ void NEONnoir::image_viewer::display(GLtexture const& texture, std::vector<shape
         }
     }
 
-    for (auto index = 0; index < regions.size(); index++)
-    {
-        auto const& region = regions[index];
+    return regions.size() != region_count;
+}
 
-        auto p0 = ImVec2{ static_cast<float>(region.x), static_cast<float>(region.y) } *_zoom + image_min;
-        auto p1 = ImVec2{ static_cast<float>(region.x + region.width), static_cast<float>(region.y + region.height) } *_zoom + image_min;
+float NEONnoir::image_viewer::get_scale() const noexcept
+{
+    return static_cast<float>(_zoom) / static_cast<float>(1 << _zoom_out);
+}
 
-        if (_selected_region_index == index)
-        {
-            draw_list->AddRectFilled(p0, p1, IM_COL32(255, 165, 0, 64));
-            draw_list->AddRect(p0, p1, IM_COL32(255, 165, 0, 255), 0.f, 0, 2.f);
-        }
-        else
-        {
-            draw_list->AddRectFilled(p0, p1, IM_COL32(13, 129, 255, 64));
-            draw_list->AddRect(p0, p1, IM_COL32(13, 129, 255, 255), 0.f, 0, 2.f);
-        }
+void NEONnoir::image_viewer::zoom_in() noexcept
+{
+    if (_zoom_out > 0)
+    {
+        _zoom_out--;
+    }
+    else
+    {
+        _zoom++;
+    }
+}
+
+void NEONnoir::image_viewer::zoom_out() noexcept
+{
+    if (_zoom > 1)
+    {
+        _zoom--;
+    }
+    else if (_zoom_out < max_zoom_out)
+    {
+        _zoom_out++;
     }
 }
 
+ImVec2 NEONnoir::image_viewer::to_image_space(ImVec2 const& screen_position, ImVec2 const& image_min) const noexcept
+{
+    auto const position = (screen_position - image_min) / get_scale();
+    return ImVec2{ std::floor(position.x), std::floor(position.y) };
+}
\ No newline at end of file
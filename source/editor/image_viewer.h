@@ -14,12 +14,23 @@ namespace NEONnoir
         ~image_viewer() = default;
 
         void display(GLtexture const& texture) noexcept;
-        void display(GLtexture const&, std::vector<shape>& regions) noexcept;
+        // Returns true when regions were added to the container
+        bool display(shape_container& container) noexcept;
         void selected_region(int32_t selected_region) { _selected_region_index = selected_region; }
 
+    private:
+        // Zooming out past 100% halves the size of the image at every step
+        static constexpr int max_zoom_out = 4;
+
+        float get_scale() const noexcept;
+        void zoom_in() noexcept;
+        void zoom_out() noexcept;
+        ImVec2 to_image_space(ImVec2 const& screen_position, ImVec2 const& image_min) const noexcept;
+
     private:
         ImVec2 _last_mouse{ 0.f, 0.f };
         int _zoom{ 1 };
+        int _zoom_out{ 0 };
 
         bool _add_region_mode{ false };
         bool _add_region_dragging{ false };
@@ -27,9 +38,16 @@ namespace NEONnoir
         bool _show_autogrid_popup{ false };
         int32_t _cell_width{ 1 };
         int32_t _cell_height{ 1 };
+        bool _skip_empty_cells{ true };
+
+        bool _show_autoslice_popup{ false };
+        int32_t _slice_background{ 0 };
+        int32_t _slice_gap{ 0 };
 
         int32_t _selected_region_index{ -1 };
         ImVec2 _add_region_p0{ -1, -1 };
+
+        std::vector<size_t> _visible_regions{};
     };
 }
 
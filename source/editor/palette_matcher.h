@@ -0,0 +1,220 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "simple_image.h"
+
+namespace MPG
+{
+    // Finds the nearest palette color to any RGB color. The RGB cube is split into 32x32x32 cells
+    // and every cell remembers which palette colors can possibly be nearest to something inside
+    // it. Most cells end up with a single one, so a lookup is a table read; cells on a border
+    // between colors keep a handful and compare the color against just those. Cells are filled
+    // the first time a color lands in them.
+    //
+    // Lookups are const and can be made from any number of threads at once. Ties go to the lowest
+    // index, the same as a plain search through the palette would give.
+    class palette_matcher
+    {
+    public:
+        explicit palette_matcher(std::span<rgba_color const> palette);
+
+        uint8_t find(uint8_t r, uint8_t g, uint8_t b) const noexcept;
+        uint8_t find(rgba_color const& color) const noexcept { return find(color.r, color.g, color.b); }
+
+        // Looks at every color of the palette, without the cells
+        uint8_t find_exact(uint8_t r, uint8_t g, uint8_t b) const noexcept;
+
+        std::span<rgba_color const> palette() const noexcept { return _palette; }
+
+    private:
+        static constexpr uint32_t cell_bits = 5;
+        static constexpr uint32_t cell_count = 1u << (cell_bits * 3);
+
+        // A cell packs how many candidates it has in the lowest byte (0 while it's not filled in
+        // yet, too_many if there were more than fit) and up to seven candidate indices above it
+        static constexpr uint64_t too_many = 0xFF;
+        static constexpr uint32_t max_candidates = 7;
+
+        uint64_t fill_cell(uint32_t cell) const noexcept;
+
+    private:
+        std::vector<rgba_color> _palette;
+
+        // The palette again, a channel at a time, for filling cells
+        std::vector<int32_t> _red;
+        std::vector<int32_t> _green;
+        std::vector<int32_t> _blue;
+
+        std::unique_ptr<std::atomic<uint64_t>[]> _cells;
+    };
+}
+
+//#define PALETTE_MATCHER_IMPL
+#ifdef PALETTE_MATCHER_IMPL
+
+#include <limits>
+#include <stdexcept>
+
+namespace MPG
+{
+    palette_matcher::palette_matcher(std::span<rgba_color const> palette)
+        : _palette{ palette.begin(), palette.end() },
+        _cells{ std::make_unique<std::atomic<uint64_t>[]>(cell_count) }
+    {
+        if (_palette.empty() || _palette.size() > shared_palette::capacity)
+            throw std::runtime_error("Palettes must have between 1 and 256 colors.");
+
+        for (auto const& color : _palette)
+        {
+            _red.push_back(color.r);
+            _green.push_back(color.g);
+            _blue.push_back(color.b);
+        }
+    }
+
+    int32_t get_color_distance(rgba_color const& color, int32_t r, int32_t g, int32_t b) noexcept
+    {
+        auto const dr = r - color.r;
+        auto const dg = g - color.g;
+        auto const db = b - color.b;
+
+        return dr * dr + dg * dg + db * db;
+    }
+
+    uint8_t palette_matcher::find(uint8_t r, uint8_t g, uint8_t b) const noexcept
+    {
+        auto const cell = (static_cast<uint32_t>(r >> 3) << 10) | (static_cast<uint32_t>(g >> 3) << 5) | static_cast<uint32_t>(b >> 3);
+
+        auto packed = _cells[cell].load(std::memory_order_acquire);
+        if (packed == 0)
+        {
+            packed = fill_cell(cell);
+        }
+
+        auto const count = packed & 0xFF;
+        if (count == 1)
+            return static_cast<uint8_t>(packed >> 8);
+
+        if (count == too_many)
+            return find_exact(r, g, b);
+
+        // The candidates are in palette order, so ties still go to the lowest index
+        auto nearest = static_cast<uint8_t>(packed >> 8);
+        auto nearest_distance = get_color_distance(_palette[nearest], r, g, b);
+
+        for (auto candidate = 1u; candidate < count; candidate++)
+        {
+            auto const index = static_cast<uint8_t>(packed >> (8 * (candidate + 1)));
+            auto const distance = get_color_distance(_palette[index], r, g, b);
+
+            if (distance < nearest_distance)
+            {
+                nearest = index;
+                nearest_distance = distance;
+            }
+        }
+
+        return nearest;
+    }
+
+    uint8_t palette_matcher::find_exact(uint8_t r, uint8_t g, uint8_t b) const noexcept
+    {
+        auto nearest = size_t{ 0 };
+        auto nearest_distance = std::numeric_limits<int32_t>::max();
+
+        for (auto index = size_t{ 0 }; index < _palette.size(); index++)
+        {
+            auto const distance = get_color_distance(_palette[index], r, g, b);
+            if (distance < nearest_distance)
+            {
+                nearest = index;
+                nearest_distance = distance;
+            }
+        }
+
+        return static_cast<uint8_t>(nearest);
+    }
+
+    // A palette color can only be nearest to something in the cell if the closest it gets to the
+    // cell is no further than the furthest the best color gets from it, and if some corner of the
+    // cell is on its side of the halfway plane between the two. Threads filling the same cell at
+    // the same time come up with the same answer, whoever stores it last doesn't matter.
+    uint64_t palette_matcher::fill_cell(uint32_t cell) const noexcept
+    {
+        constexpr auto cell_size = 1 << (8 - cell_bits);
+
+        auto const low_r = static_cast<int32_t>((cell >> 10) & 31) * cell_size;
+        auto const low_g = static_cast<int32_t>((cell >> 5) & 31) * cell_size;
+        auto const low_b = static_cast<int32_t>(cell & 31) * cell_size;
+
+        constexpr auto high = cell_size - 1;
+
+        // How close every color gets to the cell and how far it gets from it
+        auto closest = std::array<int32_t, shared_palette::capacity>{};
+        auto furthest = std::array<int32_t, shared_palette::capacity>{};
+
+        for (auto index = size_t{ 0 }; index < _palette.size(); index++)
+        {
+            auto const r = _red[index] - low_r;
+            auto const g = _green[index] - low_g;
+            auto const b = _blue[index] - low_b;
+
+            auto const closest_r = std::max(std::max(-r, r - high), 0);
+            auto const closest_g = std::max(std::max(-g, g - high), 0);
+            auto const closest_b = std::max(std::max(-b, b - high), 0);
+            closest[index] = closest_r * closest_r + closest_g * closest_g + closest_b * closest_b;
+
+            auto const furthest_r = std::max(r, high - r);
+            auto const furthest_g = std::max(g, high - g);
+            auto const furthest_b = std::max(b, high - b);
+            furthest[index] = furthest_r * furthest_r + furthest_g * furthest_g + furthest_b * furthest_b;
+        }
+
+        auto const best = static_cast<size_t>(std::min_element(furthest.begin(), furthest.begin() + _palette.size()) - furthest.begin());
+        auto const threshold = furthest[best];
+
+        // How much nearer the color gets than the best one, at the corner of the cell that favours it most
+        auto const get_advantage = [&](size_t index)
+            {
+                auto const get_term = [](int32_t value, int32_t best_value, int32_t low)
+                    {
+                        auto const corner = value > best_value ? low + high : low;
+                        return 2 * corner * (value - best_value) + best_value * best_value - value * value;
+                    };
+
+                return get_term(_red[index], _red[best], low_r) + get_term(_green[index], _green[best], low_g) + get_term(_blue[index], _blue[best], low_b);
+            };
+
+        auto packed = uint64_t{ 0 };
+        auto count = 0u;
+
+        for (auto index = size_t{ 0 }; index < _palette.size(); index++)
+        {
+            if (closest[index] > threshold || get_advantage(index) < 0)
+                continue;
+
+            // A repeated color can never win over its first appearance
+            auto const repeated = std::find(_palette.begin(), _palette.begin() + index, _palette[index]) != _palette.begin() + index;
+            if (repeated)
+                continue;
+
+            if (count == max_candidates)
+            {
+                count = too_many;
+                break;
+            }
+
+            packed |= static_cast<uint64_t>(index) << (8 * (count + 1));
+            count++;
+        }
+
+        packed = count == too_many ? too_many : packed | count;
+        _cells[cell].store(packed, std::memory_order_release);
+
+        return packed;
+    }
+}
+
+#endif // PALETTE_MATCHER_IMPL
\ No newline at end of file
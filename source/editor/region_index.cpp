@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+
+#include "shapes.h"
+#include "region_index.h"
+
+namespace NEONnoir
+{
+    void region_index::rebuild(std::vector<shape> const& regions)
+    {
+        _cells.clear();
+        _ranges.clear();
+
+        for (auto const& region : regions)
+        {
+            insert(region);
+        }
+    }
+
+    void region_index::insert(shape const& region)
+    {
+        _ranges.push_back(get_cells(region));
+        add(_ranges.size() - 1, _ranges.back());
+    }
+
+    void region_index::move(size_t id, shape const& to)
+    {
+        // Regions moving around within the same cells don't change the index
+        auto const cells = get_cells(to);
+        if (cells == _ranges[id])
+            return;
+
+        remove(id, _ranges[id]);
+        _ranges[id] = cells;
+        add(id, cells);
+    }
+
+    void region_index::erase(size_t id)
+    {
+        remove(id, _ranges[id]);
+        _ranges.erase(_ranges.begin() + id);
+
+        // Keep the ids in step with the shape list, only the cells of the regions after it change
+        for (auto other = id; other < _ranges.size(); other++)
+        {
+            renumber(_ranges[other], other + 1, other);
+        }
+    }
+
+    void region_index::query(std::vector<shape> const& regions, float x0, float y0, float x1, float y1, std::vector<size_t>& ids) const
+    {
+        ids.clear();
+
+        auto const cx0 = to_cell(x0);
+        auto const cy0 = to_cell(y0);
+        auto const cx1 = to_cell(x1);
+        auto const cy1 = to_cell(y1);
+
+        for (auto cy = cy0; cy <= cy1; cy++)
+        {
+            for (auto cx = cx0; cx <= cx1; cx++)
+            {
+                auto const cell = _cells.find(cell_key(cx, cy));
+                if (cell == _cells.end())
+                    continue;
+
+                for (auto const id : cell->second)
+                {
+                    auto const& region = regions[id];
+                    auto const left = static_cast<float>(region.x);
+                    auto const top = static_cast<float>(region.y);
+                    auto const right = left + std::max<float>(region.width, 1.f);
+                    auto const bottom = top + std::max<float>(region.height, 1.f);
+
+                    if (right <= x0 || left >= x1 || bottom <= y0 || top >= y1)
+                        continue;
+
+                    // A region can live in several cells, only report it from the cell holding the
+                    // top-left corner of its overlap with the query.
+                    if (to_cell(std::max(left, x0)) != cx || to_cell(std::max(top, y0)) != cy)
+                        continue;
+
+                    ids.push_back(id);
+                }
+            }
+        }
+
+        // Draw order should not depend on how the grid happens to be walked
+        std::sort(ids.begin(), ids.end());
+    }
+
+    region_index::cell_range region_index::get_cells(shape const& region) noexcept
+    {
+        // Empty regions still occupy the cell they sit in
+        auto const width = std::max<int32_t>(region.width, 1);
+        auto const height = std::max<int32_t>(region.height, 1);
+
+        return cell_range
+        {
+            region.x / cell_size,
+            region.y / cell_size,
+            (region.x + width - 1) / cell_size,
+            (region.y + height - 1) / cell_size
+        };
+    }
+
+    uint64_t region_index::cell_key(int32_t x, int32_t y) noexcept
+    {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+    }
+
+    int32_t region_index::to_cell(float position) noexcept
+    {
+        return static_cast<int32_t>(std::floor(position / cell_size));
+    }
+
+    void region_index::add(size_t id, cell_range const& cells)
+    {
+        for (auto cy = cells.y0; cy <= cells.y1; cy++)
+        {
+            for (auto cx = cells.x0; cx <= cells.x1; cx++)
+            {
+                _cells[cell_key(cx, cy)].push_back(static_cast<uint32_t>(id));
+            }
+        }
+    }
+
+    void region_index::remove(size_t id, cell_range const& cells)
+    {
+        for (auto cy = cells.y0; cy <= cells.y1; cy++)
+        {
+            for (auto cx = cells.x0; cx <= cells.x1; cx++)
+            {
+                auto const cell = _cells.find(cell_key(cx, cy));
+                if (cell == _cells.end())
+                    continue;
+
+                std::erase(cell->second, static_cast<uint32_t>(id));
+                if (cell->second.empty())
+                {
+                    _cells.erase(cell);
+                }
+            }
+        }
+    }
+
+    void region_index::renumber(cell_range const& cells, size_t from, size_t to)
+    {
+        for (auto cy = cells.y0; cy <= cells.y1; cy++)
+        {
+            for (auto cx = cells.x0; cx <= cells.x1; cx++)
+            {
+                std::ranges::replace(_cells[cell_key(cx, cy)], static_cast<uint32_t>(from), static_cast<uint32_t>(to));
+            }
+        }
+    }
+}
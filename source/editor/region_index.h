@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace NEONnoir
+{
+    struct shape;
+
+    // Uniform grid over a container's regions so the viewer only has to look at the regions that
+    // intersect what's on screen. Regions are referred to by their position in the container's
+    // shape list and the index is kept up to date incrementally as regions are added, moved or
+    // deleted. Every change to the shape list has to be passed on, nothing checks it behind the
+    // editor's back.
+    class region_index
+    {
+    public:
+        static constexpr int32_t cell_size = 64;
+
+        void rebuild(std::vector<shape> const& regions);
+
+        // The region must have been appended to the shape list, it gets the last id
+        void insert(shape const& region);
+        void move(size_t id, shape const& to);
+
+        // Every region after the erased one moves down by one id, just like in the shape list
+        void erase(size_t id);
+
+        // Fills ids with every region intersecting the rectangle [x0, x1) x [y0, y1), each one only once
+        void query(std::vector<shape> const& regions, float x0, float y0, float x1, float y1, std::vector<size_t>& ids) const;
+
+    private:
+        struct cell_range
+        {
+            int32_t x0, y0, x1, y1;
+
+            bool operator==(cell_range const&) const = default;
+        };
+
+        static cell_range get_cells(shape const& region) noexcept;
+        static uint64_t cell_key(int32_t x, int32_t y) noexcept;
+        static int32_t to_cell(float position) noexcept;
+
+        void add(size_t id, cell_range const& cells);
+        void remove(size_t id, cell_range const& cells);
+        void renumber(cell_range const& cells, size_t from, size_t to);
+
+    private:
+        std::unordered_map<uint64_t, std::vector<uint32_t>> _cells{};
+        std::vector<cell_range> _ranges{};      // The cells each region was added to, by id
+    };
+}
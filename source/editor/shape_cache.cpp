@@ -0,0 +1,136 @@
+#include <format>
+#include <fstream>
+#include <thread>
+
+#include "utils.h"
+#include "shapes.h"
+#include "shape_cache.h"
+
+namespace fs = std::filesystem;
+
+namespace NEONnoir
+{
+    // Bump this whenever the layout of a cached blob changes so stale entries are never reused.
+    constexpr uint64_t shape_cache_version = 3;
+
+    // 64-bit FNV-1a. Not cryptographic, but plenty to tell shapes apart.
+    class fnv1a_hasher
+    {
+    public:
+        void add(void const* data, size_t size) noexcept
+        {
+            auto bytes = static_cast<uint8_t const*>(data);
+            for (size_t i = 0; i < size; i++)
+            {
+                _hash ^= bytes[i];
+                _hash *= 0x100000001B3ull;
+            }
+        }
+
+        template<typename T>
+        void add(T const& value) noexcept
+        {
+            add(&value, sizeof(T));
+        }
+
+        uint64_t value() const noexcept { return _hash; }
+
+    private:
+        uint64_t _hash{ 0xCBF29CE484222325ull };
+    };
+
+    shape_cache::shape_cache(std::filesystem::path const& directory)
+        : _directory{ directory }
+    {
+        fs::create_directories(_directory);
+    }
+
+    std::filesystem::path shape_cache::default_directory(std::filesystem::path const& export_file)
+    {
+        return export_file.parent_path() / ".impish_cache";
+    }
+
+    std::optional<MPG::pixel_data> shape_cache::find(uint64_t key) const
+    {
+        auto const path = entry_path(key);
+
+        auto ec = std::error_code{};
+        auto const size = fs::file_size(path, ec);
+        if (ec)
+            return std::nullopt;
+
+        auto entry = std::ifstream{ path, std::ios::binary };
+        if (!entry)
+            return std::nullopt;
+
+        auto blob = MPG::pixel_data(size);
+        if (size > 0 && !entry.read(force_to<char*>(blob.data()), size))
+            return std::nullopt;
+
+        return blob;
+    }
+
+    void shape_cache::store(uint64_t key, MPG::pixel_data const& blob) const
+    {
+        auto const path = entry_path(key);
+        if (fs::exists(path))
+            return;
+
+        // Write to the side and move it in place, so a half written entry is never picked up. The
+        // same shape can be stored by two threads at once, each one gets its own temporary file.
+        auto temp_path = path;
+        temp_path += std::format(".{:x}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+        {
+            auto entry = std::ofstream{ temp_path, std::ios::binary | std::ios::trunc };
+            if (!entry)
+                throw std::runtime_error{ std::format("Could not write cache entry '{}'.", temp_path.string()) };
+
+            entry.write(force_to<char const*>(blob.data()), blob.size());
+        }
+
+        fs::rename(temp_path, path);
+    }
+
+    std::filesystem::path shape_cache::entry_path(uint64_t key) const
+    {
+        return _directory / std::format("{:016x}.shape", key);
+    }
+
+    uint64_t shape_cache_key(MPG::simple_image const& source, shape const& region, uint8_t bit_depth, MPG::dither_mode dither)
+    {
+        auto hasher = fnv1a_hasher{};
+        hasher.add(shape_cache_version);
+
+        hasher.add(region.x);
+        hasher.add(region.y);
+        hasher.add(region.width);
+        hasher.add(region.height);
+        hasher.add(region.handle_x);
+        hasher.add(region.handle_y);
+        hasher.add(region.mirror);
+        hasher.add(region.flip);
+        hasher.add(static_cast<uint8_t>(region.quarter_turns % 4));
+        hasher.add(bit_depth);
+        hasher.add(static_cast<uint8_t>(dither));
+
+        // Palettes hash themselves once, when they're made
+        hasher.add(source.bit_depth);
+        hasher.add(source.color_palette.hash());
+
+        // Only the pixels under the region matter, clamped to the image so a stray region can't read past it
+        auto const bytes_per_pixel = MPG::get_bytes_per_pixel(source.bit_depth);
+        auto const x0 = std::min<uint32_t>(region.x, source.width);
+        auto const x1 = std::min<uint32_t>(region.x + region.width, source.width);
+        auto const y0 = std::min<uint32_t>(region.y, source.height);
+        auto const y1 = std::min<uint32_t>(region.y + region.height, source.height);
+
+        for (auto y = y0; y < y1; y++)
+        {
+            auto const row_start = (static_cast<size_t>(y) * source.width + x0) * bytes_per_pixel;
+            hasher.add(source.pixel_data.data() + row_start, static_cast<size_t>(x1 - x0) * bytes_per_pixel);
+        }
+
+        return hasher.value();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <filesystem>
+#include <optional>
+#include <cstdint>
+
+#include "image_dither.h"
+#include "simple_image.h"
+
+namespace NEONnoir
+{
+    struct shape;
+
+    // Content-addressed, on-disk store of converted shapes. Each entry is the shape exactly as
+    // it is laid out in an MPSH/Blitz shapes file (header and bitplanes), keyed by a hash of
+    // everything that goes into producing it. Unchanged shapes can then skip conversion entirely.
+    // Several threads can find and store entries at the same time.
+    class shape_cache
+    {
+    public:
+        explicit shape_cache(std::filesystem::path const& directory);
+
+        // Default location of the cache for a given export file. It sits next to the export so
+        // the MPSH and Blitz exports of a project share it.
+        static std::filesystem::path default_directory(std::filesystem::path const& export_file);
+
+        std::optional<MPG::pixel_data> find(uint64_t key) const;
+        void store(uint64_t key, MPG::pixel_data const& blob) const;
+
+    private:
+        std::filesystem::path entry_path(uint64_t key) const;
+
+    private:
+        std::filesystem::path _directory;
+    };
+
+    // Hashes the source pixels under the region, the region itself, the export bit-depth, how it's
+    // dithered and the palette.
+    uint64_t shape_cache_key(MPG::simple_image const& source, shape const& region, uint8_t bit_depth, MPG::dither_mode dither);
+}
@@ -6,9 +6,12 @@
 #include <filesystem>
 #include <fstream>
 #include <format>
+#include <chrono>
+#include <algorithm>
 
 #include "utils.h"
 #include "shape_editor_tool.h"
+#include "shape_cache.h"
 
 namespace fs = std::filesystem;
 
@@ -18,6 +21,7 @@ namespace NEONnoir
     {
         auto shapes_editor_window = ImGui_window(ICON_MD_CROP " Shapes Editor Tool", false, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse);
 
+        receive_images();
         display_toolbar();
 
         if (auto table = imgui::table("main_shapes_editor_tool", 2, ImGuiTableFlags_SizingStretchProp | ImGuiTableFlags_Resizable))
@@ -29,21 +33,16 @@ namespace NEONnoir
 
             if (ImGui::Button(ICON_MD_ADD_PHOTO_ALTERNATE " Add source image", { -FLT_MIN, 0.f }))
             {
-                if (auto file = open_file_dialog("iff"))
+                // The images are decoded in the background, they show up once they're ready
+                for (auto const& file : open_files_dialog("iff"))
                 {
-                    auto container = shape_container{ file.value().data() };
-                    
                     // Keep the paths relative
-                    container.image_file = fs::relative(file.value(), fs::current_path()).string();
-                    container.image = MPG::load_image(file.value());
-                    container.texture = load_texture(container.image);
-
-                    _shape_containers.push_back(container);
+                    auto const image_file = fs::relative(file, fs::current_path()).string();
+                    _pending_images.push_back({ _image_loader.load(file), image_file });
                 }
             }
 
             auto count = 0u;
-            auto shape_id = 0;
             for (auto& container : _shape_containers)
             {
                 ImGui::PushID(force_to<void*>(&container));
@@ -66,50 +65,101 @@ namespace NEONnoir
 
                 if (_selected_image == count)
                 {
-                    for (auto i = 0; i < _selected_image; i++)
+                    auto const shape_id = to<int32_t>(get_shape_offset(count));
+                    auto const can_trim = container.image.bit_depth <= 8;
+
+                    ImGui::BeginDisabled(!can_trim);
+                    if (ImGui::Button(ICON_MD_CROP_FREE " Trim all regions", { -FLT_MIN, 0.f }))
                     {
-                        shape_id += to<int32_t>(_shape_containers[i].shapes.size());
+                        trim_container(container);
                     }
+                    ImGui::EndDisabled();
+                    ToolTip(can_trim
+                        ? "Shrink every region of this image down to its opaque pixels, the handles move so the shapes stay in place"
+                        : "Truecolor images can't be trimmed");
 
-                    auto region_count = 0;
                     //ImGui::BeginChild("regions");
-                    for (auto& shape : container.shapes)
+                    // Only the rows that are actually visible get submitted
+                    auto clipper = ImGuiListClipper{};
+                    clipper.Begin(to<int>(container.shapes.size()));
+                    while (clipper.Step())
                     {
-                        ImGui::BeginGroup();
-
-                        ImGui::PushID(force_to<void*>(&shape));
-
-                        ImGui::Text("Shape %d", shape_id + region_count);
-                        auto avail = ImGui::GetContentRegionAvail();
-                        ImGui::SameLine(avail.x - ImGui::CalcTextSize(ICON_MD_DELETE).x - (1 * spacing));
-                        if (DeleteButton("##_delete_shape"))
-                        {
-                            _shape_to_delete = region_count;
-                        }
-
-                        uint16_t const step_size = 1;
-                        ImGui::SetNextItemWidth(item_width);
-                        ImGui::InputScalar("##_x", ImGuiDataType_U16, &shape.x, &step_size, nullptr, "%u");
-                        ImGui::SameLine();
-                        ImGui::SetNextItemWidth(item_width);
-                        ImGui::InputScalar("##_y", ImGuiDataType_U16, &shape.y, &step_size, nullptr, "%u");
-                        //                    ImGui::SameLine();
-                        ImGui::SetNextItemWidth(item_width);
-                        ImGui::InputScalar("##_width", ImGuiDataType_U16, &shape.width, &step_size, nullptr, "%u");
-                        ImGui::SameLine();
-                        ImGui::SetNextItemWidth(item_width);
-                        ImGui::InputScalar("##_height", ImGuiDataType_U16, &shape.height, &step_size, nullptr, "%u");
-
-                        ImGui::EndGroup();
-
-                        if (ImGui::IsItemHovered())
+                        for (auto region_count = clipper.DisplayStart; region_count < clipper.DisplayEnd; region_count++)
                         {
-                            _shape_image.selected_region(region_count);
+                            auto& shape = container.shapes[region_count];
+
+                            ImGui::BeginGroup();
+
+                            ImGui::PushID(force_to<void*>(&shape));
+                            auto const previous = shape;
+
+                            ImGui::Text("Shape %d", shape_id + region_count);
+                            auto avail = ImGui::GetContentRegionAvail();
+                            ImGui::SameLine(avail.x - ImGui::CalcTextSize(ICON_MD_DELETE).x - ImGui::CalcTextSize(ICON_MD_CROP_FREE).x - (4 * spacing));
+                            ImGui::BeginDisabled(!can_trim);
+                            if (ImGui::Button(ICON_MD_CROP_FREE "##_trim_shape"))
+                            {
+                                trim_shape(shape, container);
+                            }
+                            ImGui::EndDisabled();
+                            ToolTip("Trim to the opaque pixels");
+                            ImGui::SameLine();
+                            if (DeleteButton("##_delete_shape"))
+                            {
+                                _shape_to_delete = region_count;
+                            }
+
+                            uint16_t const step_size = 1;
+                            ImGui::SetNextItemWidth(item_width);
+                            ImGui::InputScalar("##_x", ImGuiDataType_U16, &shape.x, &step_size, nullptr, "%u");
+                            ImGui::SameLine();
+                            ImGui::SetNextItemWidth(item_width);
+                            ImGui::InputScalar("##_y", ImGuiDataType_U16, &shape.y, &step_size, nullptr, "%u");
+                            //                    ImGui::SameLine();
+                            ImGui::SetNextItemWidth(item_width);
+                            ImGui::InputScalar("##_width", ImGuiDataType_U16, &shape.width, &step_size, nullptr, "%u");
+                            ImGui::SameLine();
+                            ImGui::SetNextItemWidth(item_width);
+                            ImGui::InputScalar("##_height", ImGuiDataType_U16, &shape.height, &step_size, nullptr, "%u");
+
+                            int16_t const handle_step = 1;
+                            ImGui::SetNextItemWidth(item_width);
+                            ImGui::InputScalar("##_handle_x", ImGuiDataType_S16, &shape.handle_x, &handle_step, nullptr, "%d");
+                            ToolTip("Handle X");
+                            ImGui::SameLine();
+                            ImGui::SetNextItemWidth(item_width);
+                            ImGui::InputScalar("##_handle_y", ImGuiDataType_S16, &shape.handle_y, &handle_step, nullptr, "%d");
+                            ToolTip("Handle Y");
+
+                            ImGui::Checkbox(ICON_MD_FLIP "##_mirror", &shape.mirror);
+                            ToolTip("Mirror left to right when exporting");
+                            ImGui::SameLine();
+                            ImGui::Checkbox(ICON_MD_SWAP_VERT "##_flip", &shape.flip);
+                            ToolTip("Flip upside down when exporting");
+                            ImGui::SameLine();
+
+                            auto turns = static_cast<int>(shape.quarter_turns % 4);
+                            ImGui::SetNextItemWidth(-FLT_MIN);
+                            if (ImGui::Combo("##_turns", &turns, "Not turned\0Quarter turn\0Half turn\0Three quarter turn\0\0"))
+                            {
+                                shape.quarter_turns = to<uint8_t>(turns);
+                            }
+                            ToolTip("Turn clockwise when exporting");
+
+                            ImGui::EndGroup();
+
+                            if (shape != previous)
+                            {
+                                container.index.move(region_count, shape);
+                            }
+
+                            if (ImGui::IsItemHovered())
+                            {
+                                _shape_image.selected_region(region_count);
+                            }
+
+                            ImGui::PopID();
                         }
-
-                        ImGui::PopID();
-
-                        region_count++;
                     }
                     //ImGui::EndChild();
                 }
@@ -118,17 +168,22 @@ namespace NEONnoir
                 ImGui::PopID();
             }
 
+            display_pending_images();
+
             if (_shape_container_to_delete)
             {
                 _shape_containers.erase(_shape_containers.begin() + _shape_container_to_delete.value());
+                _shape_offsets_dirty = true;
                 _shape_container_to_delete = std::nullopt;
                 _selected_image = std::nullopt;
             }
 
             if (_shape_to_delete && _selected_image)
             {
-                auto& container = _shape_containers[_selected_image.value()].shapes;
-                container.erase(container.begin() + _shape_to_delete.value());
+                auto& container = _shape_containers[_selected_image.value()];
+                container.index.erase(_shape_to_delete.value());
+                container.shapes.erase(container.shapes.begin() + _shape_to_delete.value());
+                _shape_offsets_dirty = true;
 
                 _shape_to_delete = std::nullopt;
             }
@@ -136,10 +191,14 @@ namespace NEONnoir
             ImGui::TableNextColumn();
             if (_selected_image.has_value())
             {
-                auto& texture = _shape_containers[_selected_image.value()].texture;
-                _shape_image.display(texture, _shape_containers[_selected_image.value()].shapes);
+                if (_shape_image.display(_shape_containers[_selected_image.value()]))
+                {
+                    _shape_offsets_dirty = true;
+                }
             }
         }
+
+        display_export_status();
     }
 
     void shape_editor_tool::display_toolbar()
@@ -152,6 +211,8 @@ namespace NEONnoir
             if (filename)
             {
                 _shape_containers = load_shape_json(filename.value());
+                _shape_offsets_dirty = true;
+                _filename = filename.value();
             }
         }
         ToolTip("Load Shapes JSON");
@@ -163,17 +224,37 @@ namespace NEONnoir
             if (filename)
             {
                 save_shape_json(filename.value(), _shape_containers);
+                _filename = filename.value();
+
+                auto ec = std::error_code{};
+                _saved_project_time = fs::last_write_time(_filename, ec);
             }
         }
         ToolTip("Save Shapes JSON");
         ImGui::SameLine();
 
+        if (ImGui::Button(ICON_MD_CROP_FREE))
+        {
+            for (auto& container : _shape_containers)
+            {
+                if (container.image.bit_depth <= 8)
+                {
+                    trim_container(container);
+                }
+            }
+        }
+        ToolTip("Trim every region of every indexed image down to its opaque pixels, the handles move so the shapes stay in place");
+        ImGui::SameLine();
+
+        // Only one export at a time
+        ImGui::BeginDisabled(_export_job != nullptr);
+
         if (ImGui::Button(ICON_MD_SWITCH_ACCOUNT))
         {
             auto filename = save_file_dialog("mpsh");
             if (filename)
             {
-                save_shape_mpsh(filename.value(), _shape_containers, to<uint8_t>(_export_bit_depth));
+                start_export(export_job::file_format::mpsh, filename.value());
             }
         }
         ToolTip("Export MPSH Shapes");
@@ -184,29 +265,437 @@ namespace NEONnoir
             auto filename = save_file_dialog("mpsh");
             if (filename)
             {
-                save_shape_blitz(filename.value(), _shape_containers, to<uint8_t>(_export_bit_depth));
+                start_export(export_job::file_format::blitz, filename.value());
             }
         }
         ToolTip("Export Blitz Shapes");
         ImGui::SameLine();
 
+        ImGui::EndDisabled();
+
         ImGui::SetNextItemWidth(200);
         ImGui::SliderInt("##slider", &_export_bit_depth, 1, 8, "Output bit-depth: %d");
         ToolTip("Clamp shapes to this bit-depth");
+        ImGui::SameLine();
+
+        ImGui::SetNextItemWidth(150);
+        ImGui::Combo("##dither", &_export_dither, "No dithering\0Ordered dither\0Floyd-Steinberg\0\0");
+        ToolTip("Dither the colors that don't fit the bit-depth instead of clamping them");
+        ImGui::SameLine();
+
+        ImGui::Checkbox(ICON_MD_PALETTE "##shared_palette", &_export_shared_palette);
+        ToolTip("Shared palette: gather every image's colors into one palette that fits the bit-depth, as the game loads one palette for all the shapes");
+        ImGui::SameLine();
+
+        ImGui::Checkbox(ICON_MD_CACHED "##incremental", &_incremental_export);
+        ToolTip("Incremental export: only convert shapes that changed since the last export");
+        ImGui::SameLine();
+
+        auto const is_watching = _watch_export_file.has_value();
+        if (is_watching)
+        {
+            ImGui::PushStyleColor(ImGuiCol_Button, ImGui::GetStyleColorVec4(ImGuiCol_ButtonActive));
+        }
+
+        if (ImGui::Button(ICON_MD_VISIBILITY))
+        {
+            if (is_watching)
+            {
+                stop_watching();
+            }
+            else if (auto filename = save_file_dialog("mpsh"))
+            {
+                start_watching(filename.value());
+            }
+        }
+
+        if (is_watching)
+        {
+            ImGui::PopStyleColor();
+            ToolTip(_watch_error.empty()
+                ? std::format("Watching for changes, last export took {:.1f} ms", _watch_last_export_ms).c_str()
+                : _watch_error.c_str());
+        }
+        else
+        {
+            ToolTip("Watch the project and its images, and re-export the MPSH when they change");
+        }
 
         ImGui::PopStyleColor();
     }
 
+    void shape_editor_tool::start_export(export_job::file_format format, std::filesystem::path const& file_path)
+    {
+        _export_status.clear();
+        _export_stages.clear();
+        _export_job = std::make_unique<export_job>(format, file_path, make_export_snapshot(), to<uint8_t>(_export_bit_depth), static_cast<MPG::dither_mode>(_export_dither), _export_shared_palette, make_export_cache(file_path));
+    }
+
+    std::vector<shape_container> shape_editor_tool::make_export_snapshot() const
+    {
+        // The job gets its own copy of the shapes. Images are decoded again as part of the export,
+        // which keeps the snapshot small, and textures belong to the UI thread.
+        auto snapshot = std::vector<shape_container>{};
+        snapshot.reserve(_shape_containers.size());
+        for (auto const& container : _shape_containers)
+        {
+            snapshot.push_back({ container.image_file, container.shapes });
+        }
+
+        return snapshot;
+    }
+
+    std::vector<shape_container> shape_editor_tool::make_watch_snapshot() const
+    {
+        auto const bit_depth = to<uint8_t>(_export_bit_depth);
+        auto const dither = static_cast<MPG::dither_mode>(_export_dither);
+
+        auto snapshot = make_export_snapshot();
+        for (auto index = size_t{ 0 }; index < snapshot.size(); index++)
+        {
+            auto const& container = _shape_containers[index];
+            snapshot[index].image_generation = container.image_generation;
+
+            // A shared palette needs every image to be looked at again
+            if (_export_shared_palette || !_watch_state.find(index, container, bit_depth, dither))
+            {
+                snapshot[index].image = container.image;
+            }
+        }
+
+        return snapshot;
+    }
+
+    void shape_editor_tool::display_export_status()
+    {
+        if (_export_job && _export_job->is_done())
+        {
+            try
+            {
+                _export_stages = _export_job->describe_stages();
+                _export_job->get();
+                _export_status = std::format("Exported '{}'", _export_job->file_path().filename().string());
+
+                if (auto const palette = _export_job->shared_palette())
+                {
+                    _export_status += palette->merged_colors > 0
+                        ? std::format(", {} colors merged into the shared palette, off by up to {:.1f}", palette->merged_colors, palette->max_error)
+                        : std::string{ ", every color fit the shared palette" };
+                }
+            }
+            catch (std::exception const& ex)
+            {
+                _export_status = ex.what();
+            }
+
+            _export_job.reset();
+        }
+
+        if (!_export_job && _export_status.empty())
+            return;
+
+        ImGui::Separator();
+
+        if (!_export_job)
+        {
+            ImGui::TextUnformatted(_export_status.c_str());
+            ToolTip(_export_stages.c_str());
+            return;
+        }
+
+        auto const total = _export_job->shapes_total();
+        auto const converted = _export_job->shapes_converted();
+        auto const fraction = total > 0 ? static_cast<float>(converted) / total : 0.f;
+        auto const progress = std::format("{} / {} shapes, {:.1f} KB written", converted, total, _export_job->bytes_written() / 1024.0);
+
+        if (ImGui::Button(ICON_MD_CANCEL))
+        {
+            _export_job->cancel();
+        }
+        ToolTip("Cancel the export");
+
+        ImGui::SameLine();
+        ImGui::ProgressBar(fraction, { -FLT_MIN, 0.f }, progress.c_str());
+        ToolTip(_export_job->describe_stages().c_str());
+    }
+
+    void shape_editor_tool::receive_images()
+    {
+        while (auto loaded = _image_loader.poll())
+        {
+            auto pending = std::ranges::find(_pending_images, loaded->ticket, &pending_image::ticket);
+            if (pending == _pending_images.end())
+                continue;
+
+            try
+            {
+                if (loaded->error)
+                {
+                    std::rethrow_exception(loaded->error);
+                }
+
+                // Only the upload has to happen here, on the UI thread
+                auto container = shape_container{ pending->image_file };
+                set_container_image(container, std::move(loaded->image));
+
+                _shape_containers.push_back(std::move(container));
+                _shape_offsets_dirty = true;
+                _pending_images.erase(pending);
+            }
+            catch (std::exception const& ex)
+            {
+                // Stays in the list until it's dismissed
+                pending->error = ex.what();
+            }
+        }
+    }
+
+    void shape_editor_tool::display_pending_images()
+    {
+        auto to_dismiss = std::optional<size_t>{};
+
+        for (auto index = size_t{ 0 }; index < _pending_images.size(); index++)
+        {
+            auto const& pending = _pending_images[index];
+            auto const image_name = fs::path{ pending.image_file }.stem().string();
+
+            ImGui::PushID(static_cast<int>(pending.ticket));
+
+            if (pending.error.empty())
+            {
+                ImGui::TextDisabled(ICON_MD_HOURGLASS_EMPTY);
+                ImGui::SameLine();
+                ImGui::TextDisabled("%s", image_name.c_str());
+                ToolTip("Loading...");
+            }
+            else
+            {
+                if (DeleteButton("##_dismiss_image"))
+                {
+                    to_dismiss = index;
+                }
+
+                ImGui::SameLine();
+                ImGui::TextColored({ 1.f, 0.4f, 0.4f, 1.f }, ICON_MD_ERROR " %s", image_name.c_str());
+                ToolTip(pending.error.c_str());
+            }
+
+            ImGui::PopID();
+        }
+
+        if (to_dismiss)
+        {
+            _pending_images.erase(_pending_images.begin() + to_dismiss.value());
+        }
+    }
+
+    size_t shape_editor_tool::get_shape_offset(size_t container_index)
+    {
+        if (_shape_offsets_dirty)
+        {
+            // Global id of the first shape of each container
+            _shape_offsets.resize(_shape_containers.size());
+
+            auto offset = size_t{ 0 };
+            for (auto index = size_t{ 0 }; index < _shape_containers.size(); index++)
+            {
+                _shape_offsets[index] = offset;
+                offset += _shape_containers[index].shapes.size();
+            }
+
+            _shape_offsets_dirty = false;
+        }
+
+        return _shape_offsets[container_index];
+    }
+
+    std::optional<shape_cache> shape_editor_tool::make_export_cache(std::filesystem::path const& export_file) const
+    {
+        if (!_incremental_export)
+            return std::nullopt;
+
+        return shape_cache{ shape_cache::default_directory(export_file) };
+    }
+
+    bool shape_editor_tool::update()
+    {
+        return update_watch();
+    }
+
+    void shape_editor_tool::start_watching(std::filesystem::path const& export_file)
+    {
+        _watch_export_file = export_file;
+        _watch_shapes.clear();
+        _watch_error.clear();
+
+        // Export straight away, everything after that only when something changes
+        _watch_pending = true;
+        _watch_changed_at = {};
+
+        watch_files();
+        update_watch();
+    }
+
+    void shape_editor_tool::stop_watching() noexcept
+    {
+        _watcher.clear();
+        _watch_export_file = std::nullopt;
+        _watch_job.reset();
+        _watch_state = {};
+        _watch_shapes.clear();
+        _watch_pending = false;
+    }
+
+    void shape_editor_tool::watch_files()
+    {
+        auto files = std::vector<fs::path>{};
+        if (!_filename.empty())
+        {
+            files.push_back(_filename);
+        }
+
+        for (auto const& container : _shape_containers)
+        {
+            files.push_back(container.image_file);
+        }
+
+        _watcher.watch(files);
+    }
+
+    bool shape_editor_tool::update_watch()
+    {
+        if (!_watch_export_file)
+            return false;
+
+        using clock = std::chrono::steady_clock;
+        auto const now = clock::now();
+        auto has_news = false;
+
+        if (_watch_job && _watch_job->is_done())
+        {
+            try
+            {
+                _watch_job->get();
+                _watch_state = *_watch_job->state();
+                _watch_error.clear();
+            }
+            catch (std::exception const& ex)
+            {
+                // The image might still be in the middle of being written, try again on the next change
+                _watch_error = ex.what();
+            }
+
+            _watch_last_export_ms = std::chrono::duration<double, std::milli>(now - _watch_started_at).count();
+            _watch_job.reset();
+            has_news = true;
+        }
+
+        auto changed_files = _watcher.poll();
+        auto const is_changed = [&changed_files](fs::path const& file)
+        {
+            auto const path = fs::absolute(file).lexically_normal();
+            return std::ranges::find(changed_files, path) != changed_files.end();
+        };
+
+        // Saving the project from the editor shows up as a change too, but what's on disk is what's
+        // already loaded
+        if (!_filename.empty() && is_changed(_filename))
+        {
+            auto ec = std::error_code{};
+            if (fs::last_write_time(_filename, ec) == _saved_project_time && !ec)
+            {
+                std::erase(changed_files, fs::absolute(_filename).lexically_normal());
+            }
+        }
+
+        if (!changed_files.empty())
+        {
+
+            try
+            {
+                if (!_filename.empty() && is_changed(_filename))
+                {
+                    // The project itself changed, start over from it
+                    _shape_containers = load_shape_json(_filename);
+                    _shape_offsets_dirty = true;
+                    _selected_image = std::nullopt;
+                    watch_files();
+                }
+                else
+                {
+                    // The export picks the new images up from here
+                    for (auto& container : _shape_containers)
+                    {
+                        if (is_changed(container.image_file))
+                        {
+                            set_container_image(container, MPG::load_image(container.image_file));
+                        }
+                    }
+                }
+            }
+            catch (std::exception const& ex)
+            {
+                _watch_error = ex.what();
+            }
+
+            // Changes on disk are already settled, they go out straight away
+            _watch_pending = true;
+            _watch_changed_at = {};
+            has_news = true;
+        }
+
+        // Containers may also have been added, removed or edited in the editor since the last look
+        auto is_edited = _watch_shapes.size() != _shape_containers.size();
+        for (auto index = size_t{ 0 }; !is_edited && index < _shape_containers.size(); index++)
+        {
+            is_edited = _watch_shapes[index] != _shape_containers[index].shapes;
+        }
+
+        if (is_edited)
+        {
+            if (_watch_shapes.size() != _shape_containers.size())
+            {
+                watch_files();
+            }
+
+            _watch_shapes.clear();
+            for (auto const& container : _shape_containers)
+            {
+                _watch_shapes.push_back(container.shapes);
+            }
+
+            _watch_pending = true;
+            _watch_changed_at = now;
+        }
+
+        // One export at a time, whatever changes in the meantime goes out with the next one
+        if (!_watch_pending || _watch_job || now - _watch_changed_at < watch_edit_delay)
+            return has_news;
+
+        _watch_pending = false;
+        _watch_started_at = now;
+        _watch_job = std::make_unique<export_job>(export_job::file_format::mpsh, _watch_export_file.value(), make_watch_snapshot(), to<uint8_t>(_export_bit_depth), static_cast<MPG::dither_mode>(_export_dither), _export_shared_palette, shape_cache{ shape_cache::default_directory(_watch_export_file.value()) }, _watch_state);
+        return true;
+    }
+
     void shape_editor_tool::save_shapes(std::filesystem::path const& shapes_file_path) const
     {
+        auto const bit_depth = to<uint8_t>(_export_bit_depth);
+        auto const dither = static_cast<MPG::dither_mode>(_export_dither);
+
         auto all_shapes = std::vector<MPG::simple_image>{};
         for (auto const& shape_container : _shape_containers)
         {
+            // Every shape of a truecolor image shares the one palette
+            auto const quantized = shape_container.image.bit_depth > 8
+                ? std::optional<MPG::simple_image>{ MPG::reduce_bit_depth(shape_container.image, bit_depth, dither) }
+                : std::nullopt;
+            auto const& source = quantized ? quantized.value() : shape_container.image;
+
             for (auto const& shape : shape_container.shapes)
             {
-                auto export_shape = MPG::crop(shape_container.image, shape.x, shape.y, shape.width, shape.height);
-                export_shape = MPG::crop_palette(export_shape, to<uint8_t>(_export_bit_depth), 0);
-                all_shapes.push_back(export_shape);
+                auto const export_shape = MPG::crop(source, shape.x, shape.y, shape.width, shape.height);
+                all_shapes.push_back(MPG::reduce_bit_depth(export_shape, bit_depth, dither));
             }
         }
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <chrono>
 #include <memory>
 #include <optional>
 #include <string>
@@ -6,6 +7,10 @@
 
 #include "simple_image.h"
 #include "image_viewer.h"
+#include "shape_cache.h"
+#include "file_watcher.h"
+#include "image_loader.h"
+#include "export_job.h"
 
 namespace NEONnoir
 {
@@ -18,9 +23,37 @@ namespace NEONnoir
 
         void display_toolbar();
 
+        // Work that has to happen whether or not anything is drawn, called every time the editor
+        // wakes up. Returns true when there's something new to show.
+        bool update();
+
+        bool is_watching() const noexcept { return _watch_export_file.has_value(); }
+
     private:
         void load_shapes(std::filesystem::path const& shapes_file_path);
         void save_shapes(std::filesystem::path const& shapes_file_path) const;
+        // Global id of the first shape of a container, as it will be numbered in the export
+        size_t get_shape_offset(size_t container_index);
+
+        std::optional<shape_cache> make_export_cache(std::filesystem::path const& export_file) const;
+
+        // The shapes of every container, without their images or textures, for an export job
+        std::vector<shape_container> make_export_snapshot() const;
+
+        // Same, but with the images of the containers the watch export has to convert again, so
+        // it doesn't have to decode what's already in memory
+        std::vector<shape_container> make_watch_snapshot() const;
+
+        void start_export(export_job::file_format format, std::filesystem::path const& file_path);
+        void display_export_status();
+
+        void receive_images();
+        void display_pending_images();
+
+        void start_watching(std::filesystem::path const& export_file);
+        void stop_watching() noexcept;
+        bool update_watch();
+        void watch_files();
 
     private:
         std::optional<size_t> _selected_image{ std::nullopt };
@@ -29,10 +62,50 @@ namespace NEONnoir
         image_viewer _shape_image;
 
         std::vector<shape_container> _shape_containers{};
+        std::vector<size_t> _shape_offsets{};
+        bool _shape_offsets_dirty{ true };
 
         std::filesystem::path _filename{};
+        std::filesystem::file_time_type _saved_project_time{};     // When the editor last wrote the project
+
+        // Source images still being decoded in the background, or that failed to load
+        struct pending_image
+        {
+            uint64_t ticket{};
+            std::string image_file{};
+            std::string error{};
+        };
+
+        image_loader _image_loader{};
+        std::vector<pending_image> _pending_images{};
 
         bool _is_open{ true };
         int32_t _export_bit_depth{ 5 };
+        int32_t _export_dither{ 0 };        // An MPG::dither_mode
+        bool _export_shared_palette{ false };
+        bool _incremental_export{ false };
+
+        // Exports run in the background, the status of the last one sticks around in the status bar
+        std::unique_ptr<export_job> _export_job{};
+        std::string _export_status{};
+        std::string _export_stages{};
+
+        // Watch mode: re-exports the MPSH whenever the project or one of its images changes on disk,
+        // or the shapes are edited. Edits only count once they've settled for a moment, so dragging
+        // a region around doesn't export on every frame. Exports run in the background and only
+        // convert the containers that changed since the last one, the rest is written from what
+        // that one converted.
+        static constexpr auto watch_edit_delay = std::chrono::milliseconds{ 300 };
+
+        file_watcher _watcher{};
+        std::optional<std::filesystem::path> _watch_export_file{ std::nullopt };
+        std::unique_ptr<export_job> _watch_job{};
+        export_state _watch_state{};
+        std::vector<std::vector<shape>> _watch_shapes{};
+        bool _watch_pending{ false };
+        std::chrono::steady_clock::time_point _watch_changed_at{};
+        std::chrono::steady_clock::time_point _watch_started_at{};
+        double _watch_last_export_ms{ 0.0 };
+        std::string _watch_error{};
     };
 }
\ No newline at end of file
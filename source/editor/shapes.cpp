@@ -2,9 +2,13 @@
 #include <format>
 #include <fstream>
 #include <sstream>
+#include <optional>
 
 #include "utils.h"
 #include "shapes.h"
+#include "shape_cache.h"
+#include "export_pipeline.h"
+#include "image_transform.h"
 
 using json = nlohmann::json;
 namespace fs = std::filesystem;
@@ -14,7 +18,9 @@ namespace NEONnoir
     NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(
         shape,
         x, y,
-        width, height
+        width, height,
+        handle_x, handle_y,
+        mirror, flip, quarter_turns
     );
 
     NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(
@@ -23,6 +29,12 @@ namespace NEONnoir
         shapes
     );
 
+    void export_control::check_cancelled() const
+    {
+        if (stop.stop_requested())
+            throw export_cancelled{};
+    }
+
     std::vector<shape_container> load_shape_json(std::filesystem::path const& file_path)
     {
         if (!fs::exists(file_path))
@@ -41,8 +53,8 @@ namespace NEONnoir
 
             for (auto& container : containers)
             {
-                container.image = MPG::load_image(container.image_file);
-                container.texture = load_texture(container.image);
+                set_container_image(container, MPG::load_image(container.image_file));
+                container.index.rebuild(container.shapes);
             }
 
             return containers;
@@ -51,6 +63,15 @@ namespace NEONnoir
         throw std::runtime_error{ "Could not read file" };
     }
 
+    void set_container_image(shape_container& container, MPG::simple_image&& image)
+    {
+        static auto next_generation = uint64_t{ 0 };
+
+        container.image = std::move(image);
+        container.texture = tiled_texture{ container.image };
+        container.image_generation = ++next_generation;
+    }
+
     void save_shape_json(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes)
     {
         auto savefile = std::ofstream{ file_path, std::ios::trunc };
@@ -61,94 +82,348 @@ namespace NEONnoir
         }
     }
 
-    void save_shape_mpsh(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth)
+    MPG::pixel_data serialize_shape(MPG::blitz_shapes const& shape)
     {
-        auto all_shapes = std::vector<MPG::blitz_shapes>{};
+        auto blob = MPG::pixel_data{};
+        blob.reserve(shape.get_size());
+
+        // Write the shape header
+        write(blob, shape.width);
+        write(blob, shape.height);
+        write(blob, shape.bit_depth);
+        write(blob, shape.ebwidth);
+        write(blob, shape.blitsize);
+
+        // Handle is relative to the top left
+        write(blob, shape.handle_x);     // x
+        write(blob, shape.handle_y);     // y
+
+        // Data and cookie pointers. They seem to always be nonsense values in the shapes files created by Blitz
+        write(blob, shape.data_ptr);     // data
+        write(blob, shape.cookie_ptr);   // cookie
+
+        write(blob, shape.onebpmem);
+        write(blob, shape.onebpmemx);
+        write(blob, shape.allbpmem);
+        write(blob, shape.allbpmemx);
+
+        write(blob, shape.padding);      // padding
+
+        // Write out the shape's bitplanes
+        blob.insert(blob.end(), shape.data.begin(), shape.data.end());
+
+        return blob;
+    }
 
+    size_t count_shapes(std::vector<shape_container> const& shapes) noexcept
+    {
+        auto count = size_t{ 0 };
         for (auto const& container : shapes)
         {
-            auto  image = MPG::crop_palette(container.image, bit_depth, 0);
-            for (auto const& shape : container.shapes)
+            count += container.shapes.size();
+        }
+
+        return count;
+    }
+
+    MPG::pixel_data convert_shape(MPG::image_view const& shape_pixels, shape const& region)
+    {
+        auto const turns = region.quarter_turns % 4;
+        if (!region.mirror && !region.flip && turns == 0)
+        {
+            auto blitz_shape = MPG::image_to_blitz_shapes(shape_pixels);
+            blitz_shape.handle_x = static_cast<uint16_t>(region.handle_x);
+            blitz_shape.handle_y = static_cast<uint16_t>(region.handle_y);
+
+            return serialize_shape(blitz_shape);
+        }
+
+        // The handle is a point on the shape, it ends up wherever its spot of the shape does
+        auto pixels = MPG::materialize(shape_pixels);
+        auto handle_x = static_cast<int32_t>(region.handle_x);
+        auto handle_y = static_cast<int32_t>(region.handle_y);
+
+        if (region.mirror)
+        {
+            MPG::mirror_horizontal_in_place(pixels);
+            handle_x = static_cast<int32_t>(pixels.width) - handle_x;
+        }
+
+        if (region.flip)
+        {
+            MPG::flip_vertical_in_place(pixels);
+            handle_y = static_cast<int32_t>(pixels.height) - handle_y;
+        }
+
+        auto const width = static_cast<int32_t>(pixels.width);
+        auto const height = static_cast<int32_t>(pixels.height);
+        auto const x = handle_x;
+        auto const y = handle_y;
+
+        switch (turns)
+        {
+        case 1:
+            MPG::rotate_in_place(pixels, MPG::rotation::clockwise);
+            handle_x = height - y;
+            handle_y = x;
+            break;
+
+        case 2:
+            MPG::rotate_in_place(pixels, MPG::rotation::half_turn);
+            handle_x = width - x;
+            handle_y = height - y;
+            break;
+
+        case 3:
+            MPG::rotate_in_place(pixels, MPG::rotation::counterclockwise);
+            handle_x = y;
+            handle_y = width - x;
+            break;
+        }
+
+        auto blitz_shape = MPG::image_to_blitz_shapes(pixels);
+        blitz_shape.handle_x = static_cast<uint16_t>(handle_x);
+        blitz_shape.handle_y = static_cast<uint16_t>(handle_y);
+
+        return serialize_shape(blitz_shape);
+    }
+
+    bool trim_shape(shape& region, shape_container& container)
+    {
+        container.coverage.update(container.image, container.image_generation, 0);
+
+        // A region with nothing in it is left alone, there's nothing to shrink it down to
+        auto const bounds = container.coverage.bounds(region.x, region.y, region.width, region.height);
+        if (bounds.width == 0 || bounds.height == 0)
+            return false;
+
+        auto trimmed = region;
+        trimmed.x = to<uint16_t>(bounds.x);
+        trimmed.y = to<uint16_t>(bounds.y);
+        trimmed.width = to<uint16_t>(bounds.width);
+        trimmed.height = to<uint16_t>(bounds.height);
+        trimmed.handle_x = static_cast<int16_t>(region.handle_x - (trimmed.x - region.x));
+        trimmed.handle_y = static_cast<int16_t>(region.handle_y - (trimmed.y - region.y));
+
+        if (trimmed == region)
+            return false;
+
+        region = trimmed;
+        return true;
+    }
+
+    size_t trim_container(shape_container& container)
+    {
+        auto trimmed = size_t{ 0 };
+        for (auto index = size_t{ 0 }; index < container.shapes.size(); index++)
+        {
+            auto& region = container.shapes[index];
+            if (trim_shape(region, container))
             {
-                auto cropped = MPG::crop(image, shape.x, shape.y, shape.width, shape.height);
-                all_shapes.push_back(MPG::image_to_blitz_shapes(cropped));
+                container.index.move(index, region);
+                trimmed++;
             }
         }
 
-        if (auto impish_file = std::ofstream{ file_path, std::ios::binary | std::ios::trunc })
+        return trimmed;
+    }
+
+    std::optional<MPG::simple_image> prepare_container_image(MPG::simple_image const& image, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette)
+    {
+        if (image.bit_depth > 8)
         {
-            auto offset = 0u;
+            auto reduced = MPG::reduce_bit_depth(image, bit_depth, dither);
+            return palette ? MPG::apply_unified_palette(reduced, *palette) : std::move(reduced);
+        }
 
-            // Write header
-            char magic[] = { 'M', 'P', 'S', 'H' };
-            impish_file.write(magic, 4);                            // Magic number
-            write(impish_file, 1u);                                 // Version. Always 1 for now
-            write(impish_file, to<uint32_t>(all_shapes.size()));      // Number of shapes
-            offset += (sizeof(uint32_t) * 3);
+        if (palette)
+            return MPG::apply_unified_palette(image, *palette);
 
-            // Push the offset past where the manifest will go
-            // The manifest is 2 uint32_ts (offset and size) per entry
-            offset += (sizeof(uint32_t) * 2 * to<uint32_t>(all_shapes.size()));
+        return std::nullopt;
+    }
 
-            // Write the manifest
-            for (auto const& shape : all_shapes)
+    MPG::unified_palette unify_container_palettes(std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, export_control* control)
+    {
+        // One image at a time, only the pixels under the shapes end up in the game
+        auto unifier = MPG::palette_unifier{};
+        for (auto const& container : shapes)
+        {
+            if (control)
             {
-                write(impish_file, offset);
+                control->check_cancelled();
+            }
 
-                auto size = to<uint32_t>(shape.get_size());
-                write(impish_file, size);
+            auto const decoded = container.image.pixel_data.empty()
+                ? std::optional<MPG::simple_image>{ MPG::load_image(container.image_file) }
+                : std::nullopt;
+            auto const& image = decoded ? decoded.value() : container.image;
 
-                offset += size;
-            }
+            auto const prepared = prepare_container_image(image, bit_depth, dither, nullptr);
+            auto const& source = prepared ? prepared.value() : image;
 
-            // Write all the shapes
-            for (auto const& shape : all_shapes)
+            for (auto const& shape : container.shapes)
             {
-                // Write the shape header
-                write(impish_file, shape.width);
-                write(impish_file, shape.height);
-                write(impish_file, shape.bit_depth);
-                write(impish_file, shape.ebwidth);
-                write(impish_file, shape.blitsize);
-
-                // Handle is in the top left. Perhaps I can add support for moving them later
-                write(impish_file, shape.handle_x);     // x
-                write(impish_file, shape.handle_y);     // y
-
-                // Data and cookie pointers. They seem to always be nonsense values in the shapes files created by Blitz
-                write(impish_file, shape.data_ptr);     // data
-                write(impish_file, shape.cookie_ptr);     // cookie
-
-                write(impish_file, shape.onebpmem);
-                write(impish_file, shape.onebpmemx);
-                write(impish_file, shape.allbpmem);
-                write(impish_file, shape.allbpmemx);
-
-                write(impish_file, shape.padding);     // padding
-
-                // Write out the shape's bitplanes
-                if (shape.data.size() > 0)
-                {
-                    impish_file.write(force_to<char const*>(&shape.data[0]), shape.data.size());
-                }
+                auto const x = std::min<uint32_t>(shape.x, source.width);
+                auto const y = std::min<uint32_t>(shape.y, source.height);
+                auto const width = std::min<uint32_t>(shape.width, source.width - x);
+                auto const height = std::min<uint32_t>(shape.height, source.height - y);
+
+                unifier.add(MPG::crop(source, x, y, width, height));
             }
         }
+
+        return unifier.unify(bit_depth);
     }
 
-    void save_shape_blitz(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth)
+    // Writes a file to the side through the given function and only moves it over the destination
+    // once it's complete. If anything goes wrong, the half-written file is removed.
+    template<typename F>
+    void write_atomically(std::filesystem::path const& file_path, F&& write_contents)
     {
-        auto all_shapes = std::vector<MPG::simple_image>{};
+        auto temp_path = file_path;
+        temp_path += ".tmp";
 
-        for (auto const& container : shapes)
+        try
         {
-            auto  image = MPG::crop_palette(container.image, bit_depth, 0);
-            for (auto const& shape : container.shapes)
             {
-                auto cropped = MPG::crop(image, shape.x, shape.y, shape.width, shape.height);
-                all_shapes.push_back(cropped);
+                auto file = std::ofstream{ temp_path, std::ios::binary | std::ios::trunc };
+                if (!file)
+                    throw std::runtime_error{ std::format("Could not write to '{}'.", temp_path.string()) };
+
+                write_contents(file);
             }
+
+            fs::rename(temp_path, file_path);
+        }
+        catch (...)
+        {
+            auto ec = std::error_code{};
+            fs::remove(temp_path, ec);
+            throw;
+        }
+    }
+
+    void write_blob(std::ofstream& file, MPG::pixel_data const& blob, export_control* control)
+    {
+        if (control)
+        {
+            control->check_cancelled();
+        }
+
+        file.write(force_to<char const*>(blob.data()), blob.size());
+
+        if (control)
+        {
+            control->bytes_written += blob.size();
+        }
+    }
+
+    // Writes the MPSH header, then lets produce_shapes hand over the shapes in order, each one
+    // written as soon as it arrives. The sizes are only known once every shape is in, so the room
+    // for the manifest is left empty and filled in at the end.
+    template<typename F>
+    void write_mpsh_contents(std::ofstream& impish_file, uint32_t shape_count, export_control* control, F&& produce_shapes)
+    {
+        // Write header
+        char magic[] = { 'M', 'P', 'S', 'H' };
+        impish_file.write(magic, 4);                            // Magic number
+        write(impish_file, 1u);                                 // Version. Always 1 for now
+        write(impish_file, shape_count);                        // Number of shapes
+
+        // The manifest is 2 uint32_ts (offset and size) per entry
+        auto const manifest_position = impish_file.tellp();
+        auto manifest = std::vector<uint32_t>{};
+        manifest.reserve(static_cast<size_t>(shape_count) * 2);
+
+        auto const manifest_size = sizeof(uint32_t) * 2 * shape_count;
+        auto const padding = std::vector<char>(manifest_size, 0);
+        impish_file.write(padding.data(), padding.size());
+
+        auto offset = to<uint32_t>(sizeof(uint32_t) * 3 + manifest_size);
+        if (control)
+        {
+            control->bytes_written += offset;
         }
 
-        MPG::save_blitz_shapes(file_path, all_shapes);
+        // Write all the shapes
+        produce_shapes([&](MPG::pixel_data const& shape)
+            {
+                write_blob(impish_file, shape, control);
+
+                auto size = to<uint32_t>(shape.size());
+                manifest.push_back(offset);
+                manifest.push_back(size);
+
+                offset += size;
+            });
+
+        if (manifest.size() != manifest_size / sizeof(uint32_t))
+            throw std::runtime_error{ "The number of shapes written doesn't match the header." };
+
+        // Write the manifest
+        impish_file.seekp(manifest_position);
+        for (auto const value : manifest)
+        {
+            write(impish_file, value);
+        }
+    }
+
+    void write_mpsh(std::filesystem::path const& file_path, std::vector<std::span<MPG::pixel_data const>> const& containers, export_control* control)
+    {
+        auto shape_count = 0u;
+        for (auto const& container : containers)
+        {
+            shape_count += to<uint32_t>(container.size());
+        }
+
+        write_atomically(file_path, [&](std::ofstream& impish_file)
+            {
+                write_mpsh_contents(impish_file, shape_count, control, [&](auto const& write_shape)
+                    {
+                        for (auto const& container : containers)
+                        {
+                            for (auto const& shape : container)
+                            {
+                                write_shape(shape);
+                            }
+                        }
+                    });
+            });
+    }
+
+    void save_shape_mpsh(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette, shape_cache const* cache, export_control* control)
+    {
+        auto const shape_count = to<uint32_t>(count_shapes(shapes));
+        if (control)
+        {
+            control->shapes_total = shape_count;
+        }
+
+        // Shapes are written as the pipeline hands them over, in order, so only the ones still
+        // being converted are ever held in memory
+        write_atomically(file_path, [&](std::ofstream& impish_file)
+            {
+                write_mpsh_contents(impish_file, shape_count, control, [&](auto const& write_shape)
+                    {
+                        run_export_pipeline(shapes, bit_depth, dither, palette, cache, control, write_shape);
+                    });
+            });
+    }
+
+    void save_shape_blitz(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette, shape_cache const* cache, export_control* control)
+    {
+        if (control)
+        {
+            control->shapes_total = count_shapes(shapes);
+        }
+
+        // A Blitz shapes file is nothing more than the shapes back to back
+        write_atomically(file_path, [&](std::ofstream& blitz_file)
+            {
+                run_export_pipeline(shapes, bit_depth, dither, palette, cache, control, [&](MPG::pixel_data const& shape)
+                    {
+                        write_blob(blitz_file, shape, control);
+                    });
+            });
     }
 }
\ No newline at end of file
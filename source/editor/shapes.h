@@ -1,15 +1,42 @@
 #pragma once
+#include <array>
+#include <atomic>
 #include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
 #include <vector>
 
+#include "coverage_table.h"
 #include "glfw_utils.h"
+#include "image_dither.h"
+#include "region_index.h"
+#include "tiled_texture.h"
+#include "unified_palette.h"
 
 namespace NEONnoir
 {
+    class shape_cache;
+
     struct shape
     {
         uint16_t x{ 0 }, y{ 0 };
         uint16_t width{ 0 }, height{ 0 };
+
+        // Where the shape is drawn from, relative to its top left corner. Trimming a shape moves
+        // the handle along with it so it still lands in the same place in the game.
+        int16_t handle_x{ 0 }, handle_y{ 0 };
+
+        // Mirrored and rotated variants of a sprite are cut from the same pixels and turned around
+        // as they're exported: mirrored first, then flipped, then turned clockwise. The handle is
+        // in the untouched region's coordinates and goes along with the pixels.
+        bool mirror{ false };
+        bool flip{ false };
+        uint8_t quarter_turns{ 0 };
+
+        bool operator==(shape const&) const = default;
     };
 
     struct shape_container
@@ -17,12 +44,113 @@ namespace NEONnoir
         std::string image_file;
         std::vector<shape> shapes;
         MPG::simple_image image;
-        GLtexture texture;
+        tiled_texture texture;
+        region_index index;
+
+        // Opaque pixels of the image, built on demand
+        coverage_table coverage;
+
+        // Different for every image ever put in a container, so whatever was worked out from the
+        // pixels can tell if they're still the same. See set_container_image.
+        uint64_t image_generation{ 0 };
     };
 
+    // Puts a freshly decoded image in the container, along with its texture. Has to be called on
+    // the UI thread.
+    void set_container_image(shape_container& container, MPG::simple_image&& image);
+
+    // The stages an export goes through, in order
+    enum class export_stage
+    {
+        load,
+        clamp,
+        crop,
+        planarize,
+        write,
+    };
+
+    constexpr auto export_stage_names = std::array{ "load", "clamp", "crop", "planarize", "write" };
+
+    // Time a stage spent working, and waiting on the stages around it. Summed over all the
+    // threads running the stage.
+    struct export_stage_stats
+    {
+        std::atomic<uint64_t> busy_us{ 0 };
+        std::atomic<uint64_t> idle_us{ 0 };
+    };
+
+    // Lets an export running on another thread report how far along it is, and be cancelled
+    struct export_control
+    {
+        std::stop_token stop{};
+        std::atomic<size_t> shapes_total{ 0 };
+        std::atomic<size_t> shapes_converted{ 0 };
+        std::atomic<uint64_t> bytes_written{ 0 };
+        std::array<export_stage_stats, export_stage_names.size()> stages{};
+
+        // Called from the export's threads every time a shape is converted, so it has to be quick
+        std::function<void()> on_progress{};
+
+        void shape_converted()
+        {
+            shapes_converted++;
+            if (on_progress)
+            {
+                on_progress();
+            }
+        }
+
+        export_stage_stats& get_stage(export_stage stage) noexcept { return stages[static_cast<size_t>(stage)]; }
+
+        // Throws export_cancelled once a stop has been requested
+        void check_cancelled() const;
+    };
+
+    class export_cancelled : public std::runtime_error
+    {
+    public:
+        export_cancelled() : std::runtime_error{ "Export cancelled." } {}
+    };
+
+    size_t count_shapes(std::vector<shape_container> const& shapes) noexcept;
+
+    // Serializes a shape, header and bitplanes, exactly as it's laid out in both MPSH and Blitz shapes files
+    MPG::pixel_data serialize_shape(MPG::blitz_shapes const& shape);
+
+    // Turns the pixels cut out for a region around as the region asks, planarizes them and
+    // serializes them with the region's handle
+    MPG::pixel_data convert_shape(MPG::image_view const& shape_pixels, shape const& region);
+
+    // Shrinks a region of the container down to the pixels in it that aren't transparent, index 0,
+    // and moves the handle so the shape is still drawn in the same place. Regions are clamped to
+    // the image first. Returns whether the region changed. Only indexed images can be trimmed.
+    bool trim_shape(shape& region, shape_container& container);
+
+    // Trims every region of the container, returns how many changed
+    size_t trim_container(shape_container& container);
+
     std::vector<shape_container> load_shape_json(std::filesystem::path const& file_path);
 
+    // Gets a container's image ready to have its shapes cut out of it: truecolor images are brought
+    // down to the bit-depth and, given a shared palette, the indices are moved onto it. Returns
+    // nothing if the image can be used as it is.
+    std::optional<MPG::simple_image> prepare_container_image(MPG::simple_image const& image, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette);
+
+    // Gathers the colors used under every container's shapes into one palette that fits the
+    // bit-depth, since the game loads a single palette for a whole bank of shapes. Containers
+    // without pixels are decoded from their image file.
+    MPG::unified_palette unify_container_palettes(std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, export_control* control = nullptr);
+
+    // Writes already converted shapes, grouped per container, as an MPSH file. The file is written
+    // to the side and moved over the destination, so readers never see a partial file, and nothing
+    // is left behind if the export fails or is cancelled.
+    void write_mpsh(std::filesystem::path const& file_path, std::vector<std::span<MPG::pixel_data const>> const& containers, export_control* control = nullptr);
+
     void save_shape_json(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes);
-    void save_shape_mpsh(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth);
-    void save_shape_blitz(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth);
+
+    // When a cache is provided, only shapes that changed since the last export are converted,
+    // everything else is assembled from the cached blobs. The output is the same either way.
+    // Without a shared palette, every container keeps its own.
+    void save_shape_mpsh(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette = nullptr, shape_cache const* cache = nullptr, export_control* control = nullptr);
+    void save_shape_blitz(std::filesystem::path const& file_path, std::vector<shape_container> const& shapes, uint8_t bit_depth, MPG::dither_mode dither, MPG::unified_palette const* palette = nullptr, shape_cache const* cache = nullptr, export_control* control = nullptr);
 }
\ No newline at end of file
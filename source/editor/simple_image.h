@@ -1,8 +1,13 @@
 #pragma once
 
 #include <vector>
+#include <array>
 #include <algorithm>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <span>
+#include <stdexcept>
 
 namespace MPG
 {
@@ -14,11 +19,60 @@ namespace MPG
         uint8_t b{ 0 };
         uint8_t a{ 255 };
         operator uint32_t() { return a << 24 | r << 16 | g << 8 | static_cast<uint32_t>(b); }
+
+        bool operator==(rgba_color const&) const = default;
     };
 
+    // A list of colors being put together, see shared_palette for what images hold on to
     using color_palette = std::vector<rgba_color>;
     using pixel_data = std::vector<uint8_t>;
 
+    // An immutable, reference counted palette. Palettes are interned: every distinct list of colors
+    // exists only once and is shared by all the images using it, so copying one is a reference
+    // count bump, and two palettes are equal if and only if they're the same object.
+    class shared_palette
+    {
+    public:
+        static constexpr size_t capacity = 256;
+
+        shared_palette();
+
+        // Finds the existing palette with these colors, or makes one
+        shared_palette(color_palette const& colors);
+        shared_palette(std::span<rgba_color const> colors);
+
+        size_t size() const noexcept { return _entry->size; }
+        bool empty() const noexcept { return _entry->size == 0; }
+
+        rgba_color const& operator[](size_t index) const noexcept { return _entry->colors[index]; }
+        rgba_color const* data() const noexcept { return _entry->colors.data(); }
+        rgba_color const* begin() const noexcept { return data(); }
+        rgba_color const* end() const noexcept { return data() + size(); }
+
+        operator std::span<rgba_color const>() const noexcept { return { data(), size() }; }
+
+        // A mutable copy of the colors, to make a new palette from
+        color_palette to_vector() const { return { begin(), end() }; }
+
+        // Computed once, when the palette is first made
+        uint64_t hash() const noexcept { return _entry->hash; }
+
+        bool operator==(shared_palette const& other) const noexcept { return _entry == other._entry; }
+
+    private:
+        struct entry
+        {
+            std::array<rgba_color, capacity> colors{};
+            size_t size{ 0 };
+            uint64_t hash{ 0 };
+        };
+
+        static std::shared_ptr<entry const> intern(std::span<rgba_color const> colors);
+
+    private:
+        std::shared_ptr<entry const> _entry;
+    };
+
     // The simplest image structure.
     struct simple_image
     {
@@ -26,23 +80,161 @@ namespace MPG
         uint32_t height{ 0 };
         uint32_t bit_depth{ 1 };
 
-        color_palette color_palette{};
+        shared_palette color_palette{};
         pixel_data pixel_data{};
     };
 
+    // Bytes used by one pixel. Anything up to 8 bits per pixel is one palette index per byte.
+    constexpr uint32_t get_bytes_per_pixel(uint32_t bit_depth) noexcept
+    {
+        return std::max(bit_depth >> 3, 1u);
+    }
+
+    // A non-owning look at an image's pixels, or part of them. Rows are stride bytes apart, so a
+    // view can cover a region of a larger image without copying anything. The image it looks at
+    // must outlive it.
+    //
+    // Simple images convert to views implicitly, so anything taking a view takes a whole image too.
+    struct image_view
+    {
+        uint8_t const* pixels{ nullptr };
+        uint32_t width{ 0 };
+        uint32_t height{ 0 };
+        size_t stride{ 0 };                     // Bytes from the start of one row to the next
+        uint32_t bytes_per_pixel{ 1 };
+        uint32_t bit_depth{ 1 };
+        shared_palette const* palette{ nullptr };
+
+        image_view() = default;
+        image_view(simple_image const& image) noexcept
+            : pixels{ image.pixel_data.data() },
+            width{ image.width },
+            height{ image.height },
+            stride{ static_cast<size_t>(image.width) * get_bytes_per_pixel(image.bit_depth) },
+            bytes_per_pixel{ get_bytes_per_pixel(image.bit_depth) },
+            bit_depth{ image.bit_depth },
+            palette{ &image.color_palette }
+        {
+        }
+
+        uint8_t const* row(uint32_t y) const noexcept { return pixels + y * stride; }
+        size_t row_size() const noexcept { return static_cast<size_t>(width) * bytes_per_pixel; }
+        bool has_palette() const noexcept { return palette != nullptr && !palette->empty(); }
+    };
+
+    // The pixel formats images come in. Routines that touch every pixel are written against these,
+    // so that the size of a pixel is a constant and their loops have a fixed stride.
+    struct indexed8
+    {
+        static constexpr uint32_t bytes_per_pixel = 1;
+    };
+
+    struct rgb24
+    {
+        static constexpr uint32_t bytes_per_pixel = 3;
+    };
+
+    struct rgba32
+    {
+        static constexpr uint32_t bytes_per_pixel = 4;
+    };
+
+    // An image view whose pixel format is part of its type
+    template<typename Format>
+    struct typed_view
+    {
+        static constexpr uint32_t bytes_per_pixel = Format::bytes_per_pixel;
+
+        uint8_t const* pixels{ nullptr };
+        uint32_t width{ 0 };
+        uint32_t height{ 0 };
+        size_t stride{ 0 };
+        uint32_t bit_depth{ 1 };
+        shared_palette const* palette{ nullptr };
+
+        explicit typed_view(image_view const& view)
+            : pixels{ view.pixels },
+            width{ view.width },
+            height{ view.height },
+            stride{ view.stride },
+            bit_depth{ view.bit_depth },
+            palette{ view.palette }
+        {
+            if (view.bytes_per_pixel != bytes_per_pixel)
+                throw std::runtime_error("The image isn't in the expected pixel format.");
+        }
+
+        uint8_t const* row(uint32_t y) const noexcept { return pixels + y * stride; }
+        uint8_t const* pixel(uint32_t x, uint32_t y) const noexcept { return row(y) + x * bytes_per_pixel; }
+        size_t row_size() const noexcept { return static_cast<size_t>(width) * bytes_per_pixel; }
+        bool has_palette() const noexcept { return palette != nullptr && !palette->empty(); }
+    };
+
+    // Works out the image's pixel format, once, and calls the function with a typed view of it
+    template<typename F>
+    decltype(auto) visit_pixels(image_view const& view, F&& function)
+    {
+        switch (view.bytes_per_pixel)
+        {
+        case indexed8::bytes_per_pixel:
+            return function(typed_view<indexed8>{ view });
+
+        case rgb24::bytes_per_pixel:
+            return function(typed_view<rgb24>{ view });
+
+        case rgba32::bytes_per_pixel:
+            return function(typed_view<rgba32>{ view });
+
+        default:
+            throw std::runtime_error("Unsupported pixel format.");
+        }
+    }
+
+    // Whether the SSSE3 paths can run here, decided when the code is built or, for x64 builds
+    // without it, by asking the CPU the first time
+    bool has_ssse3() noexcept;
+
+    // Copies the pixels under the view, and its palette, into an image of their own
+    simple_image materialize(image_view const& source);
+
     // Applies the palette to the image and returns a new 32-bit image.
     // Useful to use the image as a texture.
-    simple_image depalettize_image(simple_image const& source);
+    simple_image depalettize_image(image_view const& source);
+
+    // Same as above, but writes the RGBA pixels straight into the destination, which has to have
+    // room for them, e.g. a mapped pixel unpack buffer. Rows are destination_stride bytes apart,
+    // or tightly packed if it's 0. Indices past the end of the palette come out opaque black.
+    void depalettize_into(image_view const& source, uint8_t* destination, size_t destination_stride = 0);
 
     // Returns a new image that is flipped vertically.
-    simple_image flip_vertical(simple_image const& source);
+    simple_image flip_vertical(image_view const& source);
 
-    // Crop the image to the specified size and return it as a new image
-    simple_image crop(simple_image const& source, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    // Returns a view of a region of the image. Nothing is copied. Throws if the region doesn't fit
+    // entirely inside the image.
+    image_view crop(image_view const& source, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
 
     // Trims down the source image's palette. Any color outside the new range is changed to the overflow color
     // and returns it as a new image. This does not do any color quantizantion.
-    simple_image crop_palette(simple_image const& source, uint8_t bit_depth, uint8_t overflow_color);
+    simple_image crop_palette(image_view const& source, uint8_t bit_depth, uint8_t overflow_color);
+
+    // The palette crop_palette gives its image: the first 2^bit_depth colors, padded with black
+    color_palette crop_palette_colors(shared_palette const* palette, uint8_t bit_depth);
+
+    // Maps every palette index to a new one. Clamping, reordering and merging palettes all come
+    // down to one of these.
+    using index_remap = std::array<uint8_t, 256>;
+
+    // A remap that leaves every index as it is, to start from
+    index_remap identity_remap() noexcept;
+
+    // Replaces every palette index of an indexed image through the table, in place. The palette
+    // itself is left alone.
+    void remap_indices(simple_image& image, index_remap const& table);
+
+    // Same as above, but writes the new indices into the destination, which has to have room for
+    // them. Rows are destination_stride bytes apart, or tightly packed if it's 0. The destination
+    // can be the source's own pixels.
+    void remap_indices_into(image_view const& source, uint8_t* destination, index_remap const& table, size_t destination_stride = 0);
 
     enum class simple_image_format
     {
@@ -58,7 +250,7 @@ namespace MPG
     simple_image load_image(std::filesystem::path const& filename);
 
     simple_image load_simple_bitmap(std::filesystem::path const& filename);
-    void save_simple_bitmap(std::filesystem::path const& filename, simple_image const& image);
+    void save_simple_bitmap(std::filesystem::path const& filename, image_view const& image);
 
     // Loads an ILBM/IFF image
     // The only supported chunks are:
@@ -74,10 +266,10 @@ namespace MPG
     // Saves an image as an ILBM/IFF image
     // Since the Simple Image doesn't have any extra properties, only the minimum required to
     // make a valid ILBM is supported.
-    void save_simple_ilbm(std::filesystem::path const& filename, simple_image const& image);
+    void save_simple_ilbm(std::filesystem::path const& filename, image_view const& image);
 
     // Save a palette only ILBM
-    void save_ilbm_palette(std::filesystem::path const& filename, simple_image const& image);
+    void save_ilbm_palette(std::filesystem::path const& filename, image_view const& image);
 
     enum class ilbm_mask_type : uint8_t
     {
@@ -94,7 +286,7 @@ namespace MPG
     };
 
     pixel_data planar_to_chunky(pixel_data const& scanlines, uint32_t width, uint32_t height, uint8_t bitplanes, ilbm_mask_type mask_type);
-    pixel_data chunky_to_planar(simple_image const& image);
+    pixel_data chunky_to_planar(image_view const& image);
 
     #pragma pack(push, 2)
     // I realize this is named blitz "shapes" but it only defines one shape. That's on purpose
@@ -135,7 +327,7 @@ namespace MPG
 
     // Note that the data in the shape *IS NOT* in big-endian format, that needs to be
     // addressed when outputting it to a file.
-    blitz_shapes image_to_blitz_shapes(simple_image const& image);
+    blitz_shapes image_to_blitz_shapes(image_view const& image);
 
     // Saves a collection of images as an Amiga BLITZ Basic 2 shapes files to be used
     // with BLITZ's "LoadShapes" function.
@@ -145,11 +337,105 @@ namespace MPG
 //#define SIMPLE_IMAGE_IMPL
 #ifdef SIMPLE_IMAGE_IMPL
 
+#include <cstring>
 #include <fstream>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_map>
+
+// MSVC has the SSSE3 intrinsics on every x64 build, whether the CPU has them is checked when
+// they're first needed
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(_M_X64)
+#include <immintrin.h>
+#define MPG_IMAGE_SSSE3
+#endif
+
+#if defined(_M_X64) && !defined(__AVX2__) && !defined(__SSSE3__)
+#include <intrin.h>
+#endif
 
 namespace MPG
 {
+    bool has_ssse3() noexcept
+    {
+#if defined(__AVX2__) || defined(__SSSE3__)
+        return true;
+#elif defined(_M_X64)
+        static auto const supported = []
+            {
+                int info[4]{};
+                __cpuid(info, 1);
+                return (info[2] & (1 << 9)) != 0;
+            }();
+
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    shared_palette::shared_palette()
+        : _entry{ intern({}) }
+    {
+    }
+
+    shared_palette::shared_palette(color_palette const& colors)
+        : _entry{ intern(colors) }
+    {
+    }
+
+    shared_palette::shared_palette(std::span<rgba_color const> colors)
+        : _entry{ intern(colors) }
+    {
+    }
+
+    std::shared_ptr<shared_palette::entry const> shared_palette::intern(std::span<rgba_color const> colors)
+    {
+        if (colors.size() > capacity)
+            throw std::runtime_error("Palettes can't have more than 256 colors.");
+
+        // 64-bit FNV-1a over the colors
+        auto hash = uint64_t{ 0xcbf29ce484222325 };
+        for (auto const& color : colors)
+        {
+            for (auto const channel : { color.r, color.g, color.b, color.a })
+            {
+                hash = (hash ^ channel) * 0x100000001b3;
+            }
+        }
+        hash = (hash ^ colors.size()) * 0x100000001b3;
+
+        // Palettes are only kept alive by the images using them
+        static auto mutex = std::mutex{};
+        static auto palettes = std::unordered_map<uint64_t, std::vector<std::weak_ptr<entry const>>>{};
+
+        auto lock = std::scoped_lock{ mutex };
+        auto& bucket = palettes[hash];
+
+        for (auto existing = bucket.begin(); existing != bucket.end();)
+        {
+            auto palette = existing->lock();
+            if (!palette)
+            {
+                existing = bucket.erase(existing);
+                continue;
+            }
+
+            if (palette->size == colors.size() && std::equal(colors.begin(), colors.end(), palette->colors.begin()))
+                return palette;
+
+            existing++;
+        }
+
+        auto palette = std::make_shared<entry>();
+        std::copy(colors.begin(), colors.end(), palette->colors.begin());
+        palette->size = colors.size();
+        palette->hash = hash;
+
+        bucket.push_back(palette);
+        return palette;
+    }
+
 #pragma pack(push, 2)
     constexpr uint16_t bmp_format = 0x4D42;
 
@@ -185,6 +471,46 @@ namespace MPG
     };
 #pragma pack(pop)
 
+    // Bitmaps store truecolor pixels as BGR(A), swapping the first and third byte of every pixel
+    // converts a row either way. Source and destination may be the same row.
+    template<uint32_t BytesPerPixel>
+    void swap_red_blue(uint8_t const* source, uint8_t* destination, uint32_t width) noexcept
+    {
+        auto const row_size = static_cast<size_t>(width) * BytesPerPixel;
+        auto offset = size_t{ 0 };
+
+#ifdef MPG_IMAGE_SSSE3
+        if (has_ssse3())
+        {
+            // 24-bit rows go five pixels per 16 bytes, the last byte is stored unchanged and then
+            // picked up again by the next step
+            auto const shuffle = BytesPerPixel == 4
+                ? _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+                : _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+            auto const step = BytesPerPixel == 4 ? size_t{ 16 } : size_t{ 15 };
+
+            for (; offset + 16 <= row_size; offset += step)
+            {
+                auto const pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + offset));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset), _mm_shuffle_epi8(pixels, shuffle));
+            }
+        }
+#endif
+
+        for (; offset < row_size; offset += BytesPerPixel)
+        {
+            auto const red = source[offset + 2];
+            destination[offset + 2] = source[offset];
+            destination[offset + 1] = source[offset + 1];
+            destination[offset] = red;
+
+            if constexpr (BytesPerPixel == 4)
+            {
+                destination[offset + 3] = source[offset + 3];
+            }
+        }
+    }
+
     simple_image load_simple_bitmap(std::filesystem::path const& filename)
     {
         auto result = simple_image{};
@@ -216,62 +542,84 @@ namespace MPG
         if (bytes_per_pixel == 1)
         {
             auto const color_count = info_header.palette_color_count ? info_header.palette_color_count : 256;
-            result.color_palette.resize(color_count);
+            if (color_count > shared_palette::capacity)
+                throw std::runtime_error("Bitmap palette has too many colors.");
 
-            bitmap_file.read(reinterpret_cast<char*>(&result.color_palette[0]), sizeof(rgba_color) * color_count);
-        }
+            auto colors = color_palette(color_count);
+            bitmap_file.read(reinterpret_cast<char*>(&colors[0]), sizeof(rgba_color) * color_count);
 
-        // Bitmaps store palette colors in BRG format.
-        std::for_each(result.color_palette.begin(), result.color_palette.end(), [](rgba_color& color)
-            {
-                color = rgba_color{ color.b, color.g, color.r, 0xFF };
-            });
+            // Bitmaps store palette colors in BRG format.
+            std::for_each(colors.begin(), colors.end(), [](rgba_color& color)
+                {
+                    color = rgba_color{ color.b, color.g, color.r, 0xFF };
+                });
 
-        // Scanlines are aligned to the next 4-byte boundary
-        auto const scanline_size = result.width * bytes_per_pixel;
-        auto const remainder = scanline_size % 4;
-        auto const scanline_padding = (remainder == 0) ? 0 : 4 - remainder;
+            result.color_palette = colors;
+        }
 
-        auto scanline = std::vector<uint8_t>(scanline_size, 0);
-        auto padding = 0u;
+        // Scanlines are aligned to the next 4-byte boundary, read them whole and drop the padding
+        auto const scanline_size = static_cast<size_t>(result.width) * bytes_per_pixel;
+        auto const scanline_padding = (4 - scanline_size % 4) % 4;
+        auto scanline = std::vector<uint8_t>(scanline_size + scanline_padding);
 
-        // We need to read the whole scanline and discard the padding
-        auto const pixel_data_size = result.width * result.height * bytes_per_pixel;
-        result.pixel_data.resize(pixel_data_size);
+        result.pixel_data.resize(scanline_size * result.height);
 
-        for (int y = result.height - 1; y >= 0; y--)
+        // BMPs are stored upside down...
+        for (auto y = result.height; y-- > 0;)
         {
-            bitmap_file.read(reinterpret_cast<char*>(&scanline[0]), scanline_size);
+            if (!bitmap_file.read(reinterpret_cast<char*>(scanline.data()), scanline.size()))
+                throw std::runtime_error("Bitmap file is truncated.");
 
-            if (scanline_padding > 0)
+            auto const destination = result.pixel_data.data() + y * scanline_size;
+            switch (bytes_per_pixel)
             {
-                bitmap_file.read(reinterpret_cast<char*>(&padding), scanline_padding);
+            case 3: swap_red_blue<3>(scanline.data(), destination, result.width); break;
+            case 4: swap_red_blue<4>(scanline.data(), destination, result.width); break;
+            default: std::memcpy(destination, scanline.data(), scanline_size); break;
             }
-
-            // BMPs are stored upside down...
-            std::copy(
-                scanline.begin(), 
-                scanline.end(), 
-                result.pixel_data.begin() + (static_cast<size_t>(y) * result.width));
-
         }
 
         return result;
     }
 
-    void save_simple_bitmap(std::filesystem::path const& filename, simple_image const& source)
+    // Writes the rows bottom-up, as bitmaps store them, each one padded to the next 4-byte boundary
+    template<typename Format>
+    void write_bitmap_pixels(std::ofstream& bitmap_file, typed_view<Format> const& pixels)
     {
-        auto image = flip_vertical(source);
+        auto const row_size = pixels.row_size();
+        auto scanline = std::vector<uint8_t>(row_size + (4 - row_size % 4) % 4, 0);
 
-        auto const bmp_size = image.width * image.height * (image.bit_depth >> 3);
-        auto const palette_size = static_cast<uint32_t>(image.color_palette.size() * sizeof(rgba_color));
+        for (auto y = pixels.height; y-- > 0;)
+        {
+            if constexpr (Format::bytes_per_pixel == 1)
+            {
+                std::memcpy(scanline.data(), pixels.row(y), row_size);
+            }
+            else
+            {
+                swap_red_blue<Format::bytes_per_pixel>(pixels.row(y), scanline.data(), pixels.width);
+            }
+
+            bitmap_file.write(reinterpret_cast<char const*>(scanline.data()), scanline.size());
+        }
+    }
+
+    void save_simple_bitmap(std::filesystem::path const& filename, image_view const& image)
+    {
+        if (image.bytes_per_pixel == 1 && !image.has_palette())
+            throw std::runtime_error("Indexed bitmaps need a palette.");
+
+        auto const color_count = image.bytes_per_pixel == 1 ? image.palette->size() : size_t{ 0 };
+        auto const row_size = image.row_size();
+        auto const bmp_size = static_cast<uint32_t>((row_size + (4 - row_size % 4) % 4) * image.height);
+        auto const palette_size = static_cast<uint32_t>(color_count * sizeof(rgba_color));
 
         auto header = bmp_header
         {
             bmp_format,
-            bmp_size + palette_size,
+            static_cast<uint32_t>(sizeof(bmp_header) + sizeof(bmp_info_header)) + palette_size + bmp_size,
             0,
-            static_cast<uint32_t>(sizeof(bmp_header) + sizeof(bmp_info_header) + (image.color_palette.size() * sizeof(rgba_color)))
+            static_cast<uint32_t>(sizeof(bmp_header) + sizeof(bmp_info_header)) + palette_size
         };
 
         auto info = bmp_info_header
@@ -285,8 +633,8 @@ namespace MPG
             bmp_size,
             0,
             0,
-            static_cast<uint32_t>(image.color_palette.size()),
-            static_cast<uint32_t>(image.color_palette.size())
+            static_cast<uint32_t>(color_count),
+            static_cast<uint32_t>(color_count)
         };
 
         auto bitmap_file = std::ofstream{ filename, std::ios::binary | std::ios::trunc };
@@ -296,43 +644,19 @@ namespace MPG
         bitmap_file.write(reinterpret_cast<char*>(&header), sizeof(bmp_header));
         bitmap_file.write(reinterpret_cast<char*>(&info), sizeof(bmp_info_header));
 
-        if (image.color_palette.size() > 0)
+        if (color_count > 0)
         {
-            char padding = 0;
-
-            for (auto const& color : image.color_palette)
-            {
-                bitmap_file.write(reinterpret_cast<char const*>(&color.b), 1);
-                bitmap_file.write(reinterpret_cast<char const*>(&color.g), 1);
-                bitmap_file.write(reinterpret_cast<char const*>(&color.r), 1);
-                bitmap_file.write(&padding, 1);
-            }
-
-            // Each scanline is aligned to the next 4 byte boundary, this happens naturally for the 24-bit bitmaps since they
-            // write four bytes per pixel, but has be to accounted for with indexed images.
-            auto const scanline_padding = 4u - (image.width % 4u);
-
-            for (auto y = 0u; y < image.height; y++)
-            {
-                auto const start_index = y * image.width;
-                bitmap_file.write(reinterpret_cast<char const*>(&image.pixel_data[start_index]), image.width);
-
-                for (auto p = 0u; p < scanline_padding; p++)
+            // Palette entries are stored as BGR plus a padding byte
+            auto colors = std::vector<rgba_color>(color_count);
+            std::transform(image.palette->begin(), image.palette->end(), colors.begin(), [](rgba_color const& color)
                 {
-                    bitmap_file.write(&padding, 1);
-                }
-            }
-        }
-        else
-        {
-            for (size_t pixel = 0; pixel < image.pixel_data.size(); pixel += 4)
-            {
-                bitmap_file.write(reinterpret_cast<char const*>(&image.pixel_data[pixel + 2]), 1);
-                bitmap_file.write(reinterpret_cast<char const*>(&image.pixel_data[pixel + 1]), 1);
-                bitmap_file.write(reinterpret_cast<char const*>(&image.pixel_data[pixel]), 1);
-                bitmap_file.write(reinterpret_cast<char const*>(&image.pixel_data[pixel + 3]), 1);
-            }
+                    return rgba_color{ color.b, color.g, color.r, 0 };
+                });
+
+            bitmap_file.write(reinterpret_cast<char const*>(colors.data()), palette_size);
         }
+
+        visit_pixels(image, [&](auto const& pixels) { write_bitmap_pixels(bitmap_file, pixels); });
     }
 
     constexpr uint32_t iff_form_name = 0x464F524D;
@@ -534,7 +858,7 @@ namespace MPG
         return palette;
     }
 
-    void write_cmap_colors(std::ofstream& ofs, color_palette const& palette)
+    void write_cmap_colors(std::ofstream& ofs, shared_palette const& palette)
     {
         for (auto const& color : palette)
         {
@@ -603,8 +927,10 @@ namespace MPG
         return pixels;
     }
 
-    pixel_data chunky_to_planar(simple_image const& image)
+    pixel_data chunky_to_planar(image_view const& image)
     {
+        auto const pixels = typed_view<indexed8>{ image };
+
         auto const row_length = ((image.width + 15u) / 16u) * 2u;
         auto const scanline_length = row_length * image.bit_depth;
         auto const total_size = scanline_length * image.height;
@@ -616,7 +942,7 @@ namespace MPG
         {
             for (auto x = 0u; x < image.width; x++)
             {
-                auto const pixel = image.pixel_data[static_cast<size_t>(y) * image.width + x];
+                auto const pixel = pixels.row(y)[x];
 
                 for (auto plane = 0u; plane < image.bit_depth; plane++)
                 {
@@ -642,7 +968,7 @@ namespace MPG
         return planar;
     }
 
-    ilbm_bmhd_chunk get_bmhd_chunk(simple_image const& image)
+    ilbm_bmhd_chunk get_bmhd_chunk(image_view const& image)
     {
         return ilbm_bmhd_chunk
         {
@@ -711,16 +1037,16 @@ namespace MPG
         return result;
     }
 
-    void save_simple_ilbm(std::filesystem::path const& filename, simple_image const& image)
+    void save_simple_ilbm(std::filesystem::path const& filename, image_view const& image)
     {
         // At the moment, we only support pre-palettized images
-        if (image.bit_depth > 8 || image.color_palette.size() == 0)
+        if (image.bit_depth > 8 || !image.has_palette())
             throw std::runtime_error("Only palettized images are supported.");
 
         // Prepare our chunks and data
         auto const bmhd_data = get_bmhd_chunk(image);
         auto const bmhd_chunk = iff_chunk{ ilbm_bmhd_name, sizeof(ilbm_bmhd_chunk) };
-        auto const cmap_chunk = iff_chunk{ ilbm_cmap_name, static_cast<uint32_t>(image.color_palette.size() * sizeof(ilbm_cmap_color))};
+        auto const cmap_chunk = iff_chunk{ ilbm_cmap_name, static_cast<uint32_t>(image.palette->size() * sizeof(ilbm_cmap_color))};
         auto const camg_chunk = iff_chunk{ ilbm_camg_name, sizeof(uint32_t) };
         auto const body_data = chunky_to_planar(image);
         auto const body_chunk = iff_chunk{ ilbm_body_name, static_cast<uint32_t>(body_data.size()) };
@@ -754,7 +1080,7 @@ namespace MPG
         write_bmhd_chunk(ofs, bmhd_data);
 
         write_chunk_header(ofs, cmap_chunk);
-        write_cmap_colors(ofs, image.color_palette);
+        write_cmap_colors(ofs, *image.palette);
 
         write_chunk_header(ofs, camg_chunk);
         write_swap_u32(ofs, 0u);
@@ -766,24 +1092,23 @@ namespace MPG
         }
     }
 
-    void save_ilbm_palette(std::filesystem::path const& filename, simple_image const& image)
+    void save_ilbm_palette(std::filesystem::path const& filename, image_view const& image)
     {
-        if (image.bit_depth > 8 || image.color_palette.size() == 0)
+        if (image.bit_depth > 8 || !image.has_palette())
             throw std::runtime_error("Can't save the palette of an image without one.");
 
-        auto palette_image = simple_image
-        {
-            0, 0,
-            image.bit_depth,
-            image.color_palette,
-            {}
-        };
+        // No pixels, just the palette
+        auto palette_image = image;
+        palette_image.width = 0;
+        palette_image.height = 0;
 
         save_simple_ilbm(filename, palette_image);
     }
 
-    blitz_shapes image_to_blitz_shapes(simple_image const& image)
+    blitz_shapes image_to_blitz_shapes(image_view const& image)
     {
+        auto const pixels = typed_view<indexed8>{ image };
+
         auto shape = blitz_shapes
         {
             static_cast<uint16_t>(image.width),
@@ -822,7 +1147,7 @@ namespace MPG
                     auto const bit = 7 - (x % 8u);
 
                     // Get the bit that corresponds to this plane
-                    auto pixel = image.pixel_data[static_cast<size_t>(y) * image.width + x];
+                    auto pixel = pixels.row(y)[x];
                     auto const color_bit_mask = 1u << plane;
                     auto const color_bit = (pixel & color_bit_mask) != 0 ? 1u : 0u;
                     auto const planar_bit = color_bit << bit;
@@ -879,94 +1204,224 @@ namespace MPG
         }
     }
 
-    simple_image depalettize_image(simple_image const& source)
+    // Copies the rows of a view into a tightly packed buffer, optionally bottom to top
+    template<typename Format>
+    void copy_rows(typed_view<Format> const& source, uint8_t* destination, bool flip) noexcept
     {
-        auto result = simple_image{ source.width, source.height, 32 };
-
-        //if (source.bit_depth != 8)
-        //    throw std::runtime_error{ "Source image is not an 8bit image." };
-        if (source.color_palette.size() == 0)
-            throw std::runtime_error{ "Source image doesn't have a palette" };
-
-        result.pixel_data.reserve(static_cast<size_t>(source.width) * source.height * 4);
-
-        auto inflate = [&source, &result](auto const& pixel)
+        auto const row_size = source.row_size();
+        for (auto y = 0u; y < source.height; y++)
         {
-            auto const& color = source.color_palette[pixel];
-            result.pixel_data.push_back(color.r);
-            result.pixel_data.push_back(color.g);
-            result.pixel_data.push_back(color.b);
-            result.pixel_data.push_back(color.a);
-        };
-
-        std::ranges::for_each(source.pixel_data, inflate);
-
-        return result;
+            auto const destination_y = flip ? source.height - 1 - y : y;
+            std::memcpy(destination + destination_y * row_size, source.row(y), row_size);
+        }
     }
 
-    simple_image flip_vertical(simple_image const& source)
+    simple_image materialize(image_view const& source)
     {
         auto result = simple_image
         {
             source.width,
             source.height,
             source.bit_depth,
-            source.color_palette
+            source.palette ? *source.palette : shared_palette{}
         };
 
-        result.pixel_data.reserve(source.pixel_data.size());
+        // Rows are contiguous in the copy, even if they weren't in the source
+        result.pixel_data.resize(source.row_size() * source.height);
+        visit_pixels(source, [&](auto const& pixels) { copy_rows(pixels, result.pixel_data.data(), false); });
+
+        return result;
+    }
+
+    simple_image depalettize_image(image_view const& source)
+    {
+        auto result = simple_image{ source.width, source.height, 32 };
+        result.pixel_data.resize(static_cast<size_t>(source.width) * source.height * 4);
+
+        depalettize_into(source, result.pixel_data.data());
 
-        auto const bytes_per_pixel = source.bit_depth >> 3;
-        auto const width = static_cast<int64_t>(source.width) * bytes_per_pixel;
-        auto const height = static_cast<int64_t>(source.height) * bytes_per_pixel;
+        return result;
+    }
+
+    // Expands one row of palette indices through a table of RGBA words
+    void depalettize_row(uint8_t const* indices, uint32_t width, std::array<uint32_t, 256> const& table, uint8_t* destination) noexcept
+    {
+        auto x = 0u;
 
-        for (auto y = height - 1; y >= 0; y--)
+        // Four pixels at a time, stored together. A gather isn't any faster than four loads from
+        // a table this small, and would need AVX2, which the build doesn't assume.
+        for (; x + 4 <= width; x += 4)
         {
-            for (int x = 0; x < width; x++)
+            auto const colors = std::array<uint32_t, 4>
             {
-                result.pixel_data.push_back(source.pixel_data[y * width + x]);
-            }
+                table[indices[x]],
+                table[indices[x + 1]],
+                table[indices[x + 2]],
+                table[indices[x + 3]],
+            };
+
+            std::memcpy(destination + x * 4, colors.data(), sizeof(colors));
         }
 
-        return result;
+        for (; x < width; x++)
+        {
+            std::memcpy(destination + x * 4, &table[indices[x]], sizeof(uint32_t));
+        }
     }
 
-    simple_image crop(simple_image const& source, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+    void depalettize_into(image_view const& source, uint8_t* destination, size_t destination_stride)
     {
-        if (source.width < width || source.height < height || x >= source.width || y >= source.height)
-            throw std::exception("The crop is out of image bounds");
+        auto const pixels = typed_view<indexed8>{ source };
+        if (!pixels.has_palette())
+            throw std::runtime_error{ "Source image doesn't have a palette" };
 
+        // Every possible index as the RGBA bytes it turns into
+        auto table = std::array<uint32_t, 256>{};
+        for (auto index = size_t{ 0 }; index < table.size(); index++)
+        {
+            auto const color = index < pixels.palette->size() ? (*pixels.palette)[index] : rgba_color{};
+            auto const bytes = std::array<uint8_t, 4>{ color.r, color.g, color.b, color.a };
+            std::memcpy(&table[index], bytes.data(), sizeof(uint32_t));
+        }
+
+        auto const stride = destination_stride != 0 ? destination_stride : static_cast<size_t>(pixels.width) * 4;
+        for (auto y = 0u; y < pixels.height; y++)
+        {
+            depalettize_row(pixels.row(y), pixels.width, table, destination + y * stride);
+        }
+    }
+
+    simple_image flip_vertical(image_view const& source)
+    {
         auto result = simple_image
         {
-            width, height,
+            source.width,
+            source.height,
             source.bit_depth,
-            source.color_palette
+            source.palette ? *source.palette : shared_palette{}
         };
 
-        auto const bytes_per_pixel = std::max(source.bit_depth >> 3, 1u);
-        auto const scan_width = static_cast<int64_t>(source.width) * bytes_per_pixel;
-        auto const crop_start_x = static_cast<int64_t>(x) * bytes_per_pixel;
-        auto const crop_start_y = static_cast<int64_t>(y) * bytes_per_pixel;
-        auto const crop_end_x = crop_start_x + (static_cast<int64_t>(width) * bytes_per_pixel);
-        auto const crop_end_y = crop_start_y + (static_cast<int64_t>(height) * bytes_per_pixel);
+        result.pixel_data.resize(source.row_size() * source.height);
+        visit_pixels(source, [&](auto const& pixels) { copy_rows(pixels, result.pixel_data.data(), true); });
+
+        return result;
+    }
+
+    image_view crop(image_view const& source, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+    {
+        // The view reads straight from the source, every row of it has to be there
+        if (uint64_t{ x } + width > source.width || uint64_t{ y } + height > source.height)
+            throw std::exception("The crop is out of image bounds");
+
+        auto result = source;
+        result.pixels = source.row(y) + static_cast<size_t>(x) * source.bytes_per_pixel;
+        result.width = width;
+        result.height = height;
+
+        return result;
+    }
+
+    index_remap identity_remap() noexcept
+    {
+        auto table = index_remap{};
+        for (auto index = size_t{ 0 }; index < table.size(); index++)
+        {
+            table[index] = static_cast<uint8_t>(index);
+        }
+
+        return table;
+    }
 
-        result.pixel_data.reserve(static_cast<size_t>(width) * height * bytes_per_pixel);
+    // Looks up one row of palette indices. Images of 16 colors or less only need the first 16
+    // entries of the table, which fit in a single register to shuffle through.
+    void remap_row(uint8_t const* source, uint8_t* destination, uint32_t width, index_remap const& table, [[maybe_unused]] bool sixteen_colors) noexcept
+    {
+        auto x = 0u;
 
-        for (auto y_pos = crop_start_y; y_pos < crop_end_y; y_pos++)
+#ifdef MPG_IMAGE_SSSE3
+        if (sixteen_colors && has_ssse3())
         {
-            for (auto x_pos = crop_start_x; x_pos < crop_end_x; x_pos++)
+            auto const lookup = _mm_loadu_si128(reinterpret_cast<__m128i const*>(table.data()));
+            auto const high_nibbles = _mm_set1_epi8(static_cast<char>(0xF0));
+
+            for (; x + 16 <= width; x += 16)
             {
-                for (auto byte = 0u; byte < bytes_per_pixel; byte++)
+                auto const indices = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + x));
+
+                // The header may promise 16 colors while the pixels disagree
+                auto const in_range = _mm_cmpeq_epi8(_mm_and_si128(indices, high_nibbles), _mm_setzero_si128());
+                if (_mm_movemask_epi8(in_range) == 0xFFFF)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm_shuffle_epi8(lookup, indices));
+                }
+                else
                 {
-                    result.pixel_data.push_back(source.pixel_data[y_pos * scan_width + x_pos + byte]);
+                    for (auto i = x; i < x + 16; i++)
+                    {
+                        destination[i] = table[source[i]];
+                    }
                 }
             }
         }
+#endif
 
-        return result;
+        // Every index is read before any is written, so this works in place too
+        for (; x + 8 <= width; x += 8)
+        {
+            auto const indices = std::array<uint8_t, 8>
+            {
+                table[source[x]],
+                table[source[x + 1]],
+                table[source[x + 2]],
+                table[source[x + 3]],
+                table[source[x + 4]],
+                table[source[x + 5]],
+                table[source[x + 6]],
+                table[source[x + 7]],
+            };
+
+            std::memcpy(destination + x, indices.data(), indices.size());
+        }
+
+        for (; x < width; x++)
+        {
+            destination[x] = table[source[x]];
+        }
+    }
+
+    void remap_indices_into(image_view const& source, uint8_t* destination, index_remap const& table, size_t destination_stride)
+    {
+        auto const pixels = typed_view<indexed8>{ source };
+        auto const sixteen_colors = pixels.bit_depth <= 4;
+
+        auto const stride = destination_stride != 0 ? destination_stride : static_cast<size_t>(pixels.width);
+        for (auto y = 0u; y < pixels.height; y++)
+        {
+            remap_row(pixels.row(y), destination + y * stride, pixels.width, table, sixteen_colors);
+        }
+    }
+
+    void remap_indices(simple_image& image, index_remap const& table)
+    {
+        remap_indices_into(image, image.pixel_data.data(), table);
+    }
+
+    color_palette crop_palette_colors(shared_palette const* palette, uint8_t bit_depth)
+    {
+        if (bit_depth > 8)
+            throw std::runtime_error("Bit-depth can't be more than 8");
+
+        auto colors = color_palette(size_t{ 1 } << bit_depth);
+        if (palette)
+        {
+            auto const kept = std::min(colors.size(), palette->size());
+            std::copy(palette->begin(), palette->begin() + kept, colors.begin());
+        }
+
+        return colors;
     }
 
-    simple_image crop_palette(simple_image const& source, uint8_t bit_depth, uint8_t overflow_color)
+    simple_image crop_palette(image_view const& source, uint8_t bit_depth, uint8_t overflow_color)
     {
         auto const color_count = 1 << bit_depth;
 
@@ -980,34 +1435,14 @@ namespace MPG
             bit_depth
         };
 
-        // Create a new palette with the requested colors
-        auto const max_colors = std::min(color_count, static_cast<int>(source.color_palette.size()));
-
-        result.color_palette.resize(color_count);
-        std::copy(
-            source.color_palette.begin(),
-            source.color_palette.begin() + max_colors,
-            result.color_palette.begin()
-        );
-
-        if (source.color_palette.size() < color_count || source.bit_depth <= bit_depth)
-        {
-            for (auto i = source.color_palette.size(); i < color_count; i++)
-            {
-                result.color_palette[i] = rgba_color{};
-            }
-        }
+        result.color_palette = crop_palette_colors(source.palette, bit_depth);
 
         // Adjust any colors that are out of range
+        auto table = identity_remap();
+        std::fill(table.begin() + std::min(color_count, 256), table.end(), overflow_color);
+
         result.pixel_data.resize(static_cast<size_t>(source.width) * source.height);
-        std::transform(
-            source.pixel_data.begin(),
-            source.pixel_data.end(),
-            result.pixel_data.begin(),
-            [&color_count, &overflow_color](uint8_t pixel)
-            {
-                return (pixel >= color_count) ? overflow_color : pixel;
-            });
+        remap_indices_into(source, result.pixel_data.data(), table);
 
         return result;
     }
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "simple_image.h"
+
+namespace MPG
+{
+    // Finds the separate sprites on a hand-packed sheet. Every pixel that isn't the background
+    // index belongs to a sprite, and pixels that touch, diagonals included, belong to the same one.
+    //
+    // Rows are scanned for runs of sprite pixels, 16 pixels at a time where the SIMD is there.
+    // Every run starts out as a sprite of its own and is joined with the runs it touches in the
+    // rows above with a union-find, then a second pass over the runs adds up the bounding boxes.
+    // Nothing is ever done per pixel apart from finding where the runs start and end.
+
+    struct pixel_rect
+    {
+        uint32_t x{ 0 };
+        uint32_t y{ 0 };
+        uint32_t width{ 0 };
+        uint32_t height{ 0 };
+
+        bool operator==(pixel_rect const&) const = default;
+    };
+
+    // Returns the bounding box of every sprite, in the order their top rows appear on the sheet.
+    // Sprites with no more than gap background pixels between them, across or down, count as one,
+    // which keeps things like a character and its detached shadow together. Throws for truecolor
+    // images.
+    std::vector<pixel_rect> find_sprites(image_view const& source, uint8_t background, uint32_t gap = 0);
+}
+
+//#define SPRITE_SLICER_IMPL
+#ifdef SPRITE_SLICER_IMPL
+
+#include <bit>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(__AVX2__)
+#include <emmintrin.h>
+#define MPG_SLICER_SSE2
+#endif
+
+namespace MPG
+{
+    // A stretch of sprite pixels on one row, from first to last, both included
+    struct pixel_run
+    {
+        uint32_t first{ 0 };
+        uint32_t last{ 0 };
+        uint32_t y{ 0 };
+    };
+
+    // Where the next pixel that is, or isn't, the background starts, or the end of the row
+    template<bool FindBackground>
+    uint32_t find_next(uint8_t const* row, uint32_t x, uint32_t width, uint8_t background) noexcept
+    {
+#ifdef MPG_SLICER_SSE2
+        auto const match = _mm_set1_epi8(static_cast<char>(background));
+        for (; x + 16 <= width; x += 16)
+        {
+            auto const pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + x));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(pixels, match)));
+            if constexpr (!FindBackground)
+            {
+                mask = ~mask & 0xFFFF;
+            }
+
+            if (mask != 0)
+                return x + std::countr_zero(mask);
+        }
+#endif
+
+        for (; x < width; x++)
+        {
+            if ((row[x] == background) == FindBackground)
+                return x;
+        }
+
+        return width;
+    }
+
+    // Runs of sprite pixels are sprites in their own right until they're joined. The lowest run
+    // always ends up the root, so results don't depend on the order things are joined in.
+    class run_sets
+    {
+    public:
+        uint32_t add()
+        {
+            _parents.push_back(static_cast<uint32_t>(_parents.size()));
+            return _parents.back();
+        }
+
+        uint32_t find(uint32_t run) noexcept
+        {
+            while (_parents[run] != run)
+            {
+                _parents[run] = _parents[_parents[run]];
+                run = _parents[run];
+            }
+
+            return run;
+        }
+
+        void join(uint32_t lhs, uint32_t rhs) noexcept
+        {
+            auto const left = find(lhs);
+            auto const right = find(rhs);
+
+            if (left < right)
+            {
+                _parents[right] = left;
+            }
+            else if (right < left)
+            {
+                _parents[left] = right;
+            }
+        }
+
+    private:
+        std::vector<uint32_t> _parents{};
+    };
+
+    std::vector<pixel_rect> find_sprites(image_view const& source, uint8_t background, uint32_t gap)
+    {
+        if (source.bytes_per_pixel > 1)
+            throw std::runtime_error("Only indexed images can be sliced.");
+
+        auto runs = std::vector<pixel_run>{};
+        auto row_starts = std::vector<size_t>{};
+        row_starts.reserve(static_cast<size_t>(source.height) + 1);
+
+        auto sets = run_sets{};
+
+        // Runs this many columns apart or less, on rows this many apart or less, are one sprite
+        auto const reach = static_cast<int64_t>(gap) + 1;
+
+        for (auto y = 0u; y < source.height; y++)
+        {
+            auto const row = source.row(y);
+            auto const row_start = runs.size();
+            row_starts.push_back(row_start);
+
+            for (auto x = find_next<false>(row, 0, source.width, background); x < source.width; )
+            {
+                auto const end = find_next<true>(row, x, source.width, background);
+                runs.push_back({ x, end - 1, y });
+                auto const run = sets.add();
+
+                // The run before it on the same row, if the gap between them is small enough
+                if (run > row_start && static_cast<int64_t>(x) - runs[run - 1].last <= reach)
+                {
+                    sets.join(run - 1, run);
+                }
+
+                x = find_next<false>(row, end, source.width, background);
+            }
+
+            // Join every new run with the runs it reaches on the rows above
+            auto const first_row = y > gap ? y - gap - 1 : 0;
+            for (auto above = first_row; above < y; above++)
+            {
+                auto const above_begin = row_starts[above];
+                auto const above_end = row_starts[above + 1];
+                auto candidate = above_begin;
+
+                for (auto run = row_start; run < runs.size(); run++)
+                {
+                    auto const first = static_cast<int64_t>(runs[run].first) - reach;
+                    auto const last = static_cast<int64_t>(runs[run].last) + reach;
+
+                    // Runs on a row are in order, and so are the ones they reach
+                    while (candidate < above_end && runs[candidate].last < first)
+                    {
+                        candidate++;
+                    }
+
+                    for (auto other = candidate; other < above_end && runs[other].first <= last; other++)
+                    {
+                        sets.join(static_cast<uint32_t>(other), static_cast<uint32_t>(run));
+                    }
+                }
+            }
+        }
+
+        // Every root is the topmost, leftmost run of its sprite, so boxes come out in reading order
+        auto boxes = std::vector<pixel_rect>{};
+        auto box_of_root = std::vector<uint32_t>(runs.size());
+
+        for (auto run = uint32_t{ 0 }; run < runs.size(); run++)
+        {
+            auto const& pixels = runs[run];
+            auto const root = sets.find(run);
+
+            if (root == run)
+            {
+                box_of_root[run] = static_cast<uint32_t>(boxes.size());
+                boxes.push_back({ pixels.first, pixels.y, pixels.last - pixels.first + 1, 1 });
+                continue;
+            }
+
+            auto& box = boxes[box_of_root[root]];
+            auto const right = std::max(box.x + box.width, pixels.last + 1);
+            box.x = std::min(box.x, pixels.first);
+            box.width = right - box.x;
+            box.height = pixels.y - box.y + 1;
+        }
+
+        return boxes;
+    }
+}
+
+#endif // SPRITE_SLICER_IMPL
\ No newline at end of file
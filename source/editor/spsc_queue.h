@@ -0,0 +1,56 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <optional>
+
+namespace NEONnoir
+{
+    // Fixed-size, lock-free queue for handing things from exactly one producer thread to exactly
+    // one consumer thread. Neither side ever blocks: pushing to a full queue or popping from an
+    // empty one just fails and it's up to the caller to try again later.
+    template<typename T, size_t Capacity>
+    class spsc_queue
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        // Producer side
+        bool try_push(T&& value)
+        {
+            auto const tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) == Capacity)
+                return false;
+
+            _slots[tail & (Capacity - 1)] = std::move(value);
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side
+        std::optional<T> try_pop()
+        {
+            auto const head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire))
+                return std::nullopt;
+
+            auto value = std::optional<T>{ std::move(_slots[head & (Capacity - 1)]) };
+            _slots[head & (Capacity - 1)] = T{};
+            _head.store(head + 1, std::memory_order_release);
+            return value;
+        }
+
+        bool is_empty() const noexcept
+        {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::array<T, Capacity> _slots{};
+
+        // Kept on separate cache lines so the two threads don't fight over them
+        alignas(64) std::atomic<size_t> _head{ 0 };
+        alignas(64) std::atomic<size_t> _tail{ 0 };
+    };
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+namespace NEONnoir
+{
+    thread_pool::thread_pool(size_t thread_count)
+    {
+        _workers.reserve(thread_count);
+        for (auto index = size_t{ 0 }; index < std::max(thread_count, size_t{ 1 }); index++)
+        {
+            _workers.emplace_back([this](std::stop_token stop) { run(stop); });
+        }
+    }
+
+    thread_pool::~thread_pool() noexcept
+    {
+        {
+            auto lock = std::scoped_lock{ _mutex };
+            _tasks.clear();
+        }
+
+        for (auto& worker : _workers)
+        {
+            worker.request_stop();
+        }
+
+        // Joined as they go out of scope
+        _workers.clear();
+    }
+
+    void thread_pool::submit(std::function<void()> task)
+    {
+        {
+            auto lock = std::scoped_lock{ _mutex };
+            _tasks.push_back(std::move(task));
+        }
+
+        _task_available.notify_one();
+    }
+
+    size_t thread_pool::default_thread_count() noexcept
+    {
+        // hardware_concurrency() is allowed to give up and return 0
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    void thread_pool::run(std::stop_token stop)
+    {
+        while (true)
+        {
+            auto task = std::function<void()>{};
+
+            {
+                auto lock = std::unique_lock{ _mutex };
+                if (!_task_available.wait(lock, stop, [this] { return !_tasks.empty(); }))
+                    return;
+
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NEONnoir
+{
+    // A fixed set of worker threads picking tasks off a shared queue, first come first served.
+    // Tasks must not throw, anything that can fail has to hand its error back some other way.
+    class thread_pool
+    {
+    public:
+        explicit thread_pool(size_t thread_count = default_thread_count());
+
+        // Tasks that haven't started yet are dropped, the ones already running are waited on
+        ~thread_pool() noexcept;
+
+        thread_pool(thread_pool const&) = delete;
+        thread_pool& operator=(thread_pool const&) = delete;
+
+        void submit(std::function<void()> task);
+
+        size_t size() const noexcept { return _workers.size(); }
+
+        // One thread per core
+        static size_t default_thread_count() noexcept;
+
+    private:
+        void run(std::stop_token stop);
+
+    private:
+        std::mutex _mutex{};
+        std::condition_variable_any _task_available{};
+        std::deque<std::function<void()>> _tasks{};
+
+        std::vector<std::jthread> _workers{};
+    };
+}
\ No newline at end of file
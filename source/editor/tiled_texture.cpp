@@ -0,0 +1,227 @@
+#include <glad/gl.h>
+#include <algorithm>
+#include <cmath>
+
+#include "tiled_texture.h"
+
+namespace NEONnoir
+{
+    tiled_texture::tiled_texture(MPG::simple_image const& image)
+        : _state{ std::make_shared<state>() }
+    {
+        _state->is_indexed = image.bit_depth <= 8;
+        if (_state->is_indexed)
+        {
+            _state->palette_id = create_palette_texture(image.color_palette);
+        }
+    }
+
+    tiled_texture::state::~state() noexcept
+    {
+        for (auto const& tile : tiles)
+        {
+            glDeleteTextures(1, &tile.texture_id);
+        }
+
+        if (palette_id != 0)
+        {
+            glDeleteTextures(1, &palette_id);
+        }
+    }
+
+    void tiled_texture::update_palette(std::span<MPG::rgba_color const> palette)
+    {
+        if (_state && _state->palette_id != 0)
+        {
+            update_palette_texture(_state->palette_id, palette);
+        }
+    }
+
+    void tiled_texture::draw(ImDrawList* draw_list, MPG::simple_image const& image, ImVec2 const& origin, float scale, int32_t zoom_out_level)
+    {
+        if (!_state || image.width == 0 || image.height == 0)
+            return;
+
+        _state->frame++;
+
+        // Work out which tiles can be seen
+        auto const clip_min = draw_list->GetClipRectMin();
+        auto const clip_max = draw_list->GetClipRectMax();
+
+        auto level = std::clamp(zoom_out_level, 0, 8);
+        auto tile_span = 0;
+        auto span = 0.f;
+        auto first_x = 0, first_y = 0, last_x = 0, last_y = 0;
+        while (true)
+        {
+            // How many source pixels one tile covers at this level
+            tile_span = tile_size << level;
+            span = tile_span * scale;
+
+            auto const tiles_x = (static_cast<int32_t>(image.width) + tile_span - 1) / tile_span;
+            auto const tiles_y = (static_cast<int32_t>(image.height) + tile_span - 1) / tile_span;
+
+            first_x = std::max(static_cast<int32_t>(std::floor((clip_min.x - origin.x) / span)), 0);
+            first_y = std::max(static_cast<int32_t>(std::floor((clip_min.y - origin.y) / span)), 0);
+            last_x = std::min(static_cast<int32_t>(std::floor((clip_max.x - origin.x) / span)), tiles_x - 1);
+            last_y = std::min(static_cast<int32_t>(std::floor((clip_max.y - origin.y) / span)), tiles_y - 1);
+
+            // If the view needs more tiles than the budget allows, draw it from a coarser level
+            // instead, so the tiles on screen can always be recycled
+            auto const visible = static_cast<size_t>(std::max(last_x - first_x + 1, 0)) * std::max(last_y - first_y + 1, 0);
+            if (visible <= tile_budget || level == 8)
+                break;
+
+            level++;
+        }
+
+        if (_state->is_indexed)
+        {
+            begin_palette_draw(draw_list, _state->palette_id);
+        }
+
+        for (auto y = first_y; y <= last_y; y++)
+        {
+            for (auto x = first_x; x <= last_x; x++)
+            {
+                auto const& tile = get_tile(image, level, x, y);
+
+                // Edge tiles are only partially filled
+                auto const source_width = std::min(tile_span, static_cast<int32_t>(image.width) - x * tile_span);
+                auto const source_height = std::min(tile_span, static_cast<int32_t>(image.height) - y * tile_span);
+
+                auto const p0 = ImVec2{ origin.x + x * span, origin.y + y * span };
+                auto const p1 = ImVec2{ p0.x + source_width * scale, p0.y + source_height * scale };
+                auto const uv1 = ImVec2
+                {
+                    static_cast<float>(source_width) / tile_span,
+                    static_cast<float>(source_height) / tile_span
+                };
+
+                draw_list->AddImage(reinterpret_cast<ImTextureID>(static_cast<intptr_t>(tile.texture_id)), p0, p1, { 0.f, 0.f }, uv1);
+            }
+        }
+
+        if (_state->is_indexed)
+        {
+            end_palette_draw(draw_list);
+        }
+    }
+
+    uint64_t tiled_texture::tile_key(int32_t level, int32_t x, int32_t y) noexcept
+    {
+        return (static_cast<uint64_t>(level) << 48) | (static_cast<uint64_t>(y) << 24) | static_cast<uint64_t>(x);
+    }
+
+    tiled_texture::tile const& tiled_texture::get_tile(MPG::simple_image const& image, int32_t level, int32_t x, int32_t y)
+    {
+        auto& state = *_state;
+        auto const key = tile_key(level, x, y);
+
+        if (auto const resident = state.resident.find(key); resident != state.resident.end())
+        {
+            auto& tile = state.tiles[resident->second];
+            tile.last_used = state.frame;
+            return tile;
+        }
+
+        // Recycle the least recently used tile. Draw keeps the visible tiles within the budget, so
+        // that's only ever a tile on screen for an image too large for even the coarsest level.
+        auto const lru = std::min_element(state.tiles.begin(), state.tiles.end(), [](tile const& lhs, tile const& rhs)
+            {
+                return lhs.last_used < rhs.last_used;
+            });
+
+        auto slot = size_t{ 0 };
+        if (state.tiles.size() < tile_budget || lru == state.tiles.end() || lru->last_used == state.frame)
+        {
+            auto tile = tiled_texture::tile{};
+            glGenTextures(1, &tile.texture_id);
+            glBindTexture(GL_TEXTURE_2D, tile.texture_id);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            if (state.is_indexed)
+            {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, tile_size, tile_size, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+            }
+            else
+            {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tile_size, tile_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            }
+
+            slot = state.tiles.size();
+            state.tiles.push_back(tile);
+        }
+        else
+        {
+            slot = static_cast<size_t>(lru - state.tiles.begin());
+            state.resident.erase(lru->key);
+        }
+
+        auto& tile = state.tiles[slot];
+        tile.key = key;
+        tile.last_used = state.frame;
+        state.resident[key] = slot;
+
+        upload_tile(tile, image, level, x, y);
+
+        return tile;
+    }
+
+    // Every 2^level-th pixel of the region, expanded to what the tile texture holds: palette indices
+    // for indexed images, RGBA for everything else
+    template<typename Format>
+    void decimate(MPG::typed_view<Format> const& source, int32_t level, int32_t texels_x, int32_t texels_y, uint8_t* destination) noexcept
+    {
+        auto const step = static_cast<size_t>(Format::bytes_per_pixel) << level;
+
+        for (auto ty = 0; ty < texels_y; ty++)
+        {
+            auto pixel = source.row(static_cast<uint32_t>(ty) << level);
+
+            for (auto tx = 0; tx < texels_x; tx++, pixel += step)
+            {
+                if constexpr (Format::bytes_per_pixel == 1)
+                {
+                    *destination++ = pixel[0];
+                }
+                else
+                {
+                    *destination++ = pixel[0];
+                    *destination++ = pixel[1];
+                    *destination++ = pixel[2];
+                    *destination++ = Format::bytes_per_pixel == 4 ? pixel[3] : 0xFF;
+                }
+            }
+        }
+    }
+
+    void tiled_texture::upload_tile(tile const& tile, MPG::simple_image const& image, int32_t level, int32_t x, int32_t y)
+    {
+        auto& staging = _state->staging;
+
+        auto const tile_span = tile_size << level;
+        auto const source_x = x * tile_span;
+        auto const source_y = y * tile_span;
+        auto const source_width = std::min(tile_span, static_cast<int32_t>(image.width) - source_x);
+        auto const source_height = std::min(tile_span, static_cast<int32_t>(image.height) - source_y);
+
+        // Texels actually covered by the image, every 2^level-th pixel of the source
+        auto const texels_x = (source_width + (1 << level) - 1) >> level;
+        auto const texels_y = (source_height + (1 << level) - 1) >> level;
+
+        auto const bytes_per_texel = _state->is_indexed ? 1u : 4u;
+        staging.resize(static_cast<size_t>(texels_x) * texels_y * bytes_per_texel);
+
+        auto const region = MPG::crop(image, source_x, source_y, source_width, source_height);
+        MPG::visit_pixels(region, [&](auto const& pixels) { decimate(pixels, level, texels_x, texels_y, staging.data()); });
+
+        glBindTexture(GL_TEXTURE_2D, tile.texture_id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texels_x, texels_y, _state->is_indexed ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE, staging.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "glfw_utils.h"
+
+namespace NEONnoir
+{
+    // Draws a source image from a grid of fixed-size tiles instead of one big texture. Tiles are
+    // only uploaded once they scroll into view and the least recently used ones are recycled once
+    // the budget is reached, so an image can be as large as it needs to be, regardless of the
+    // driver's GL_MAX_TEXTURE_SIZE. Zoomed out views draw from downsampled tiles, and so does any
+    // view that would need more tiles than the budget.
+    //
+    // Copies share the same tiles, which are released along with the last copy. That has to
+    // happen on the thread owning the GL context.
+    class tiled_texture
+    {
+    public:
+        static constexpr int32_t tile_size = 256;
+        static constexpr size_t tile_budget = 256;     // 16 MB worth of indexed tiles
+
+        tiled_texture() = default;
+        explicit tiled_texture(MPG::simple_image const& image);
+
+        bool is_valid() const noexcept { return _state != nullptr; }
+
+        void update_palette(std::span<MPG::rgba_color const> palette);
+
+        // Draws the image with its top-left corner at origin. Only the tiles intersecting the
+        // draw list's clip rect are drawn. Each zoom out level halves the tiles' resolution.
+        void draw(ImDrawList* draw_list, MPG::simple_image const& image, ImVec2 const& origin, float scale, int32_t zoom_out_level);
+
+    private:
+        struct tile
+        {
+            GLuint texture_id{};
+            uint64_t key{};
+            uint64_t last_used{};
+        };
+
+        struct state
+        {
+            ~state() noexcept;
+
+            bool is_indexed{ true };
+            GLuint palette_id{};
+            uint64_t frame{ 0 };
+
+            std::vector<tile> tiles{};
+            std::unordered_map<uint64_t, size_t> resident{};
+            std::vector<uint8_t> staging{};
+        };
+
+        static uint64_t tile_key(int32_t level, int32_t x, int32_t y) noexcept;
+        tile const& get_tile(MPG::simple_image const& image, int32_t level, int32_t x, int32_t y);
+        void upload_tile(tile const& tile, MPG::simple_image const& image, int32_t level, int32_t x, int32_t y);
+
+    private:
+        std::shared_ptr<state> _state{};
+    };
+}
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "simple_image.h"
+
+namespace MPG
+{
+    // One palette for several indexed images, for when they all end up drawn with the same one.
+    // Index 0 is the transparent color of every image, so it stays index 0 whatever its color. The
+    // other colors the images use are gathered up, weighted by how many pixels use them. If they
+    // don't all fit, the ones kept are picked for being both used a lot and far from the colors
+    // already kept, and the rest are merged into their nearest. Colors keep the index they had in
+    // the first image using them wherever they can, so images that already share a palette come
+    // out of it unchanged.
+    struct unified_palette
+    {
+        color_palette colors{};
+        std::vector<uint8_t> used{};            // The indices holding a color, apart from 0. Unused ones in between are black.
+        size_t merged_colors{ 0 };              // Distinct colors that didn't fit and were merged into another
+        float max_error{ 0.f };                 // How far the worst of those moved, as a distance in RGB
+
+        bool operator==(unified_palette const&) const = default;
+    };
+
+    // Counts the colors of the images that will share a palette, a few at a time so they don't all
+    // have to be in memory at once. Images sharing a palette are counted together.
+    class palette_unifier
+    {
+    public:
+        // Throws if the image is truecolor
+        void add(image_view const& image);
+
+        unified_palette unify(uint8_t bit_depth) const;
+
+    private:
+        // How many pixels use every index, added up over the images drawn with one palette
+        struct palette_usage
+        {
+            shared_palette palette{};
+            std::array<uint64_t, 256> counts{};
+        };
+
+        std::vector<palette_usage> _usages{};
+    };
+
+    // Same as adding every image to a palette_unifier
+    unified_palette unify_palettes(std::span<image_view const> images, uint8_t bit_depth);
+
+    // Where every index of the palette goes on the unified one: index 0 stays, every other index
+    // goes to the nearest color. Indices past the end of the palette count as black.
+    index_remap make_unified_remap(shared_palette const* palette, unified_palette const& unified);
+
+    // Returns a copy of the indexed image moved onto the unified palette, in a single pass through
+    // the remap
+    simple_image apply_unified_palette(image_view const& source, unified_palette const& unified);
+}
+
+//#define UNIFIED_PALETTE_IMPL
+#ifdef UNIFIED_PALETTE_IMPL
+
+#include <cmath>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "palette_matcher.h"
+
+namespace MPG
+{
+    // The colors of a palette by index, indices past its end are black
+    std::array<rgba_color, 256> expand_palette(shared_palette const& palette) noexcept
+    {
+        auto colors = std::array<rgba_color, 256>{};
+        std::copy_n(palette.begin(), std::min(palette.size(), colors.size()), colors.begin());
+
+        return colors;
+    }
+
+    uint32_t get_rgb_key(rgba_color const& color) noexcept
+    {
+        return static_cast<uint32_t>(color.r) << 16 | static_cast<uint32_t>(color.g) << 8 | color.b;
+    }
+
+    // A color some image uses, with the index it had where it was first seen
+    struct gathered_color
+    {
+        rgba_color color{};
+        uint64_t count{ 0 };
+        size_t home{ 0 };
+    };
+
+    void palette_unifier::add(image_view const& image)
+    {
+        if (image.bytes_per_pixel > 1)
+            throw std::runtime_error("Only indexed images can share a palette.");
+
+        // Palettes are interned, so the same colors are always the same palette
+        auto const palette = image.palette ? *image.palette : shared_palette{};
+        auto usage = std::find_if(_usages.begin(), _usages.end(), [&](palette_usage const& existing)
+            {
+                return existing.palette == palette;
+            });
+
+        if (usage == _usages.end())
+        {
+            _usages.push_back({ palette });
+            usage = _usages.end() - 1;
+        }
+
+        for (auto y = 0u; y < image.height; y++)
+        {
+            auto const row = image.row(y);
+            for (auto x = 0u; x < image.width; x++)
+            {
+                usage->counts[row[x]]++;
+            }
+        }
+    }
+
+    // Every color in use apart from the transparent ones, once each, in the order they're first seen
+    void gather_colors(shared_palette const& palette, std::array<uint64_t, 256> const& counts, std::vector<gathered_color>& colors, std::unordered_map<uint32_t, size_t>& lookup)
+    {
+        auto const expanded = expand_palette(palette);
+        for (auto index = size_t{ 1 }; index < expanded.size(); index++)
+        {
+            if (counts[index] == 0)
+                continue;
+
+            auto const [found, added] = lookup.try_emplace(get_rgb_key(expanded[index]), colors.size());
+            if (added)
+            {
+                colors.push_back({ expanded[index], 0, index });
+            }
+
+            colors[found->second].count += counts[index];
+        }
+    }
+
+    // Picks which colors get an index of their own. The first is the one used the most, after that
+    // every pick is the color with the most pixels times squared distance to the nearest color
+    // picked so far, so a little used color still gets in if nothing else is like it.
+    std::vector<bool> pick_colors(std::vector<gathered_color> const& colors, size_t room)
+    {
+        auto picked = std::vector<bool>(colors.size(), colors.size() <= room);
+        if (colors.size() <= room)
+            return picked;
+
+        // Further than any two colors can be
+        auto distances = std::vector<uint64_t>(colors.size(), 3 * 255 * 255 + 1);
+
+        for (auto round = size_t{ 0 }; round < room; round++)
+        {
+            auto best = size_t{ 0 };
+            auto best_score = uint64_t{ 0 };
+            for (auto index = size_t{ 0 }; index < colors.size(); index++)
+            {
+                auto const score = picked[index] ? 0 : colors[index].count * distances[index];
+                if (score > best_score)
+                {
+                    best = index;
+                    best_score = score;
+                }
+            }
+
+            if (best_score == 0)
+                break;
+
+            picked[best] = true;
+
+            auto const& chosen = colors[best].color;
+            for (auto index = size_t{ 0 }; index < colors.size(); index++)
+            {
+                auto const dr = static_cast<int32_t>(colors[index].color.r) - chosen.r;
+                auto const dg = static_cast<int32_t>(colors[index].color.g) - chosen.g;
+                auto const db = static_cast<int32_t>(colors[index].color.b) - chosen.b;
+                distances[index] = std::min(distances[index], static_cast<uint64_t>(dr * dr + dg * dg + db * db));
+            }
+        }
+
+        return picked;
+    }
+
+    // The colors that were given an index, without the transparent one and the unused ones
+    color_palette get_used_colors(unified_palette const& unified)
+    {
+        auto colors = color_palette{};
+        for (auto const slot : unified.used)
+        {
+            colors.push_back(unified.colors[slot]);
+        }
+
+        return colors;
+    }
+
+    unified_palette palette_unifier::unify(uint8_t bit_depth) const
+    {
+        if (bit_depth < 1 || bit_depth > 8)
+            throw std::runtime_error("Bit-depth must be between 1 and 8");
+
+        auto colors = std::vector<gathered_color>{};
+        auto lookup = std::unordered_map<uint32_t, size_t>{};
+        for (auto const& usage : _usages)
+        {
+            gather_colors(usage.palette, usage.counts, colors, lookup);
+        }
+
+        auto const capacity = size_t{ 1 } << bit_depth;
+        auto const picked = pick_colors(colors, capacity - 1);
+
+        // The most used colors get first go at the index they came with, the others take whatever is left
+        auto order = std::vector<size_t>{};
+        for (auto index = size_t{ 0 }; index < colors.size(); index++)
+        {
+            if (picked[index])
+            {
+                order.push_back(index);
+            }
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs)
+            {
+                return colors[lhs].count > colors[rhs].count;
+            });
+
+        auto slots = std::vector<std::optional<size_t>>(capacity);
+        auto homeless = std::vector<size_t>{};
+        for (auto const index : order)
+        {
+            auto const home = colors[index].home;
+            if (home < capacity && !slots[home])
+            {
+                slots[home] = index;
+            }
+            else
+            {
+                homeless.push_back(index);
+            }
+        }
+
+        // Back in the order they were seen, so the result doesn't depend on ties in the counts
+        std::sort(homeless.begin(), homeless.end());
+
+        auto next_free = size_t{ 1 };
+        for (auto const index : homeless)
+        {
+            while (slots[next_free])
+            {
+                next_free++;
+            }
+
+            slots[next_free] = index;
+        }
+
+        auto result = unified_palette{};
+
+        // The transparent color is whatever the first image had at index 0
+        result.colors.push_back(_usages.empty() ? rgba_color{} : expand_palette(_usages.front().palette)[0]);
+
+        for (auto slot = size_t{ 1 }; slot < capacity; slot++)
+        {
+            if (slots[slot])
+            {
+                result.colors.resize(slot + 1);
+                result.colors[slot] = colors[slots[slot].value()].color;
+                result.used.push_back(static_cast<uint8_t>(slot));
+            }
+        }
+
+        // How far the colors that didn't make it had to move
+        result.merged_colors = colors.size() - order.size();
+        if (result.merged_colors > 0)
+        {
+            auto const kept = get_used_colors(result);
+            auto const matcher = palette_matcher{ kept };
+            for (auto index = size_t{ 0 }; index < colors.size(); index++)
+            {
+                if (picked[index])
+                    continue;
+
+                auto const& color = colors[index].color;
+                auto const& nearest = kept[matcher.find(color)];
+
+                auto const dr = static_cast<float>(color.r) - nearest.r;
+                auto const dg = static_cast<float>(color.g) - nearest.g;
+                auto const db = static_cast<float>(color.b) - nearest.b;
+                result.max_error = std::max(result.max_error, std::sqrt(dr * dr + dg * dg + db * db));
+            }
+        }
+
+        return result;
+    }
+
+    unified_palette unify_palettes(std::span<image_view const> images, uint8_t bit_depth)
+    {
+        auto unifier = palette_unifier{};
+        for (auto const& image : images)
+        {
+            unifier.add(image);
+        }
+
+        return unifier.unify(bit_depth);
+    }
+
+    index_remap make_unified_remap(shared_palette const* palette, unified_palette const& unified)
+    {
+        auto table = index_remap{};
+        if (unified.used.empty())
+            return table;
+
+        auto const matcher = palette_matcher{ get_used_colors(unified) };
+        auto const colors = expand_palette(palette ? *palette : shared_palette{});
+
+        for (auto index = size_t{ 1 }; index < table.size(); index++)
+        {
+            table[index] = unified.used[matcher.find(colors[index])];
+        }
+
+        return table;
+    }
+
+    simple_image apply_unified_palette(image_view const& source, unified_palette const& unified)
+    {
+        if (source.bytes_per_pixel > 1)
+            throw std::runtime_error("Only indexed images can share a palette.");
+
+        // The unified palette can be longer than the image's own
+        auto result = simple_image{ source.width, source.height, 8 };
+        result.color_palette = unified.colors;
+        result.pixel_data.resize(static_cast<size_t>(source.width) * source.height);
+
+        remap_indices_into(source, result.pixel_data.data(), make_unified_remap(source.palette, unified));
+
+        return result;
+    }
+}
+
+#endif // UNIFIED_PALETTE_IMPL
\ No newline at end of file
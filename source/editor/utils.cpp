@@ -4,6 +4,15 @@
 #include <nfd.h>
 #include <fstream>
 #include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
 #include "utils.h"
 
 namespace NEONnoir
@@ -19,6 +28,25 @@ namespace NEONnoir
         return {};
     }
 
+    std::vector<std::string> open_files_dialog(std::string_view const& filter)
+    {
+        auto files = std::vector<std::string>{};
+
+        auto paths = nfdpathset_t{};
+        if (NFD_OpenDialogMultiple(filter.data(), nullptr, &paths) == NFD_OKAY)
+        {
+            auto const count = NFD_PathSet_GetCount(&paths);
+            for (auto index = size_t{ 0 }; index < count; index++)
+            {
+                files.emplace_back(NFD_PathSet_GetPath(&paths, index));
+            }
+
+            NFD_PathSet_Free(&paths);
+        }
+
+        return files;
+    }
+
     std::optional<std::string_view> save_file_dialog(std::string_view const& filter)
     {
         nfdchar_t* path = nullptr;
@@ -45,6 +73,69 @@ namespace NEONnoir
         stream.write(&data[1], 1);
         stream.write(&data[0], 1);
     }
+
+    void write(std::vector<uint8_t>& buffer, uint16_t value)
+    {
+        buffer.push_back(static_cast<uint8_t>(value >> 8));
+        buffer.push_back(static_cast<uint8_t>(value));
+    }
+
+    void write(std::vector<uint8_t>& buffer, uint32_t value)
+    {
+        buffer.push_back(static_cast<uint8_t>(value >> 24));
+        buffer.push_back(static_cast<uint8_t>(value >> 16));
+        buffer.push_back(static_cast<uint8_t>(value >> 8));
+        buffer.push_back(static_cast<uint8_t>(value));
+    }
+
+    double get_process_cpu_seconds() noexcept
+    {
+#ifdef _WIN32
+        auto creation_time = FILETIME{};
+        auto exit_time = FILETIME{};
+        auto kernel_time = FILETIME{};
+        auto user_time = FILETIME{};
+        if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+            return 0.0;
+
+        // FILETIMEs count 100ns intervals
+        auto const to_seconds = [](FILETIME const& time)
+        {
+            return static_cast<double>((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7;
+        };
+
+        return to_seconds(kernel_time) + to_seconds(user_time);
+#else
+        auto usage = rusage{};
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0.0;
+
+        auto const to_seconds = [](timeval const& time)
+        {
+            return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) * 1e-6;
+        };
+
+        return to_seconds(usage.ru_utime) + to_seconds(usage.ru_stime);
+#endif
+    }
+
+    void cpu_usage_meter::update() noexcept
+    {
+        _frames++;
+
+        auto const now = std::chrono::steady_clock::now();
+        auto const elapsed = std::chrono::duration<double>(now - _sample_start).count();
+        if (elapsed < 1.0)
+            return;
+
+        auto const cpu_now = get_process_cpu_seconds();
+        _cpu_percent = (cpu_now - _sample_cpu_start) / elapsed * 100.0;
+        _frames_per_second = _frames / elapsed;
+
+        _sample_start = now;
+        _sample_cpu_start = cpu_now;
+        _frames = 0;
+    }
 }
 
-#pragma warning(pop)
\ No newline at end of file
+#pragma warning(pop)
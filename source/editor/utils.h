@@ -1,10 +1,16 @@
 #pragma once
 #include <optional>
+#include <string>
 #include <string_view>
+#include <vector>
+#include <cstdint>
+#include <chrono>
 
 namespace NEONnoir
 {
     std::optional<std::string_view> open_file_dialog(std::string_view const& filter);
+    // Empty if the dialog was cancelled
+    std::vector<std::string> open_files_dialog(std::string_view const& filter);
     std::optional<std::string_view> save_file_dialog(std::string_view const& filter);
 
     template<char... T>
@@ -28,4 +34,31 @@ namespace NEONnoir
 
     void write(std::ofstream& stream, uint16_t value);
     void write(std::ofstream& stream, uint32_t value);
+
+    // Same as above, but appends the big-endian value to an in-memory buffer
+    void write(std::vector<uint8_t>& buffer, uint16_t value);
+    void write(std::vector<uint8_t>& buffer, uint32_t value);
+
+    // CPU time used by the whole process so far, in seconds
+    double get_process_cpu_seconds() noexcept;
+
+    // Keeps track of how busy the editor is, as a percentage of one core, and how often it redraws.
+    // The numbers are refreshed about once a second.
+    class cpu_usage_meter
+    {
+    public:
+        // Call once per frame
+        void update() noexcept;
+
+        double cpu_percent() const noexcept { return _cpu_percent; }
+        double frames_per_second() const noexcept { return _frames_per_second; }
+
+    private:
+        std::chrono::steady_clock::time_point _sample_start{ std::chrono::steady_clock::now() };
+        double _sample_cpu_start{ get_process_cpu_seconds() };
+        uint32_t _frames{ 0 };
+
+        double _cpu_percent{ 0.0 };
+        double _frames_per_second{ 0.0 };
+    };
 }
\ No newline at end of file